@@ -0,0 +1,436 @@
+#include "Server.h"
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <system_error>
+#include "Utils/Exception.h"
+#include "Manager/DocumentCache.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+#endif
+
+namespace {
+    // JSON-RPC 2.0 error codes
+    constexpr int ErrParse = -32700;
+    constexpr int ErrInvalidRequest = -32600;
+    constexpr int ErrMethodNotFound = -32601;
+    constexpr int ErrInvalidParams = -32602;
+    constexpr int ErrServer = -32000;
+    // a client that sends this much without a line break is not speaking the protocol
+    constexpr std::size_t MaxLineLength = 16 * 1024 * 1024;
+    // how long to stop accepting after running out of descriptors, the waiting connection would wake poll right away
+    constexpr auto AcceptBackoff = std::chrono::milliseconds(100);
+
+    struct RpcError: std::runtime_error {
+        RpcError(int code, const std::string& message): std::runtime_error(message), Code(code) {}
+        int Code;
+    };
+
+    [[noreturn]] void RaiseErrno(const char* what) { throw std::system_error(errno, std::generic_category(), what); }
+
+    nlohmann::json ErrorOf(const nlohmann::json& id, int code, const std::string& message, nlohmann::json data = nullptr) {
+        nlohmann::json error{{"code", code}, {"message", message}};
+        if (!data.is_null()) error["data"] = std::move(data);
+        return {{"jsonrpc", "2.0"}, {"id", id}, {"error", std::move(error)}};
+    }
+
+    const std::string& StringParam(const nlohmann::json& params, const char* name) {
+        const auto x = params.find(name);
+        if (x==params.end() || !x->is_string()) throw RpcError(ErrInvalidParams, std::string("Missing string parameter '")+name+'\'');
+        return x->get_ref<const std::string&>();
+    }
+
+    Configure::Manager::Materialize ModeParam(const nlohmann::json& params) {
+        using Configure::Manager::Materialize;
+        static constexpr std::pair<std::string_view, Materialize> modes[] = {
+                {"symlink", Materialize::Symlink}, {"hardlink", Materialize::HardLink}, {"reflink", Materialize::Reflink},
+                {"pinned", Materialize::Pinned}, {"snapshot", Materialize::Snapshot}
+        };
+        const auto x = params.find("mode");
+        if (x==params.end()) return Materialize::Symlink;
+        for (auto&& [name, mode] : modes) if (*x==name) return mode;
+        throw RpcError(ErrInvalidParams, "Unknown materialization mode");
+    }
+
+    nlohmann::json StepOf(const Configure::Manager::ReconcileStep& step) {
+        static constexpr const char* actions[] = {"link", "unlink", "relink"};
+        return {
+                {"action", actions[step.Action]}, {"module", step.Module},
+                {"from", step.From.generic_string()}, {"to", step.To.generic_string()}
+        };
+    }
+
+    // a request that only reads can be answered from the published view without waiting for the writer
+    bool IsQuery(const nlohmann::json& request) {
+        if (request.is_array()) return std::all_of(request.begin(), request.end(), [](auto& x) { return IsQuery(x); });
+        if (!request.is_object()) return true;
+        const auto method = request.find("method");
+        return method==request.end() || *method=="list" || *method=="status";
+    }
+
+    bool IsQuery(const std::string& line) {
+        // malformed requests are answered right away with the parse error
+        try { return IsQuery(nlohmann::json::parse(line)); }
+        catch (...) { return true; }
+    }
+
+    nlohmann::json StatsOf(const Utils::CloneStats& stats) { return {{"copied", stats.Copied}, {"shared", stats.Shared}}; }
+}
+
+namespace Configure::Daemon {
+    std::string Server::Handle(const std::string& line) {
+        nlohmann::json request{};
+        try { request = nlohmann::json::parse(line); }
+        catch (const std::exception& e) { return ErrorOf(nullptr, ErrParse, e.what()).dump(); }
+        if (!request.is_array()) {
+            auto response = Dispatch(request);
+            return response.is_null() ? std::string{} : response.dump();
+        }
+        // a batch is answered with the array of the responses, notifications in it get none
+        if (request.empty()) return ErrorOf(nullptr, ErrInvalidRequest, "Empty batch").dump();
+        auto responses = nlohmann::json::array();
+        for (auto&& x : request) if (auto response = Dispatch(x); !response.is_null()) responses.push_back(std::move(response));
+        return responses.empty() ? std::string{} : responses.dump();
+    }
+
+    nlohmann::json Server::Dispatch(const nlohmann::json& request) {
+        if (!request.is_object()) return ErrorOf(nullptr, ErrInvalidRequest, "Request is not an object");
+        const auto id = request.find("id");
+        const auto notify = id==request.end();
+        const auto idValue = notify ? nlohmann::json{} : *id;
+        const auto method = request.find("method");
+        if (method==request.end() || !method->is_string()) return ErrorOf(idValue, ErrInvalidRequest, "Missing method");
+        const auto params = request.find("params");
+        try {
+            auto result = Call(*method, params!=request.end() ? *params : nlohmann::json::object());
+            if (notify) return nullptr;
+            return {{"jsonrpc", "2.0"}, {"id", idValue}, {"result", std::move(result)}};
+        }
+        catch (const RpcError& e) { return notify ? nlohmann::json{} : ErrorOf(idValue, e.Code, e.what()); }
+        catch (const Utils::ErrorList& e) { return notify ? nlohmann::json{} : ErrorOf(idValue, ErrServer, e.what(), e.ToJson()); }
+        catch (const std::exception& e) { return notify ? nlohmann::json{} : ErrorOf(idValue, ErrServer, e.what()); }
+    }
+
+    nlohmann::json Server::Call(const std::string& method, const nlohmann::json& params) {
+        if (!params.is_object()) throw RpcError(ErrInvalidParams, "Parameters must be given by name");
+        if (method=="import") return Import(params);
+        if (method=="update") return Update(params);
+        if (method=="checkout") return Checkout(params);
+        if (method=="list") return List(params);
+        if (method=="status") return Status(params);
+        throw RpcError(ErrMethodNotFound, "Method not found: "+method);
+    }
+
+    // {"uri"}, or {"uris": [...]} answered with the error of each import, null where it succeeded
+    nlohmann::json Server::Import(const nlohmann::json& params) {
+        const auto uris = params.find("uris");
+        if (uris==params.end()) {
+            mHouse.ImportCabinet(StringParam(params, "uri"));
+            return nullptr;
+        }
+        if (!uris->is_array() || !std::all_of(uris->begin(), uris->end(), [](auto& x) { return x.is_string(); })) {
+            throw RpcError(ErrInvalidParams, "Parameter 'uris' must be a list of strings");
+        }
+        auto result = nlohmann::json::array();
+        for (auto&& x : mHouse.ImportCabinets(uris->get<std::vector<std::string>>())) {
+            if (!x) {
+                result.push_back(nullptr);
+                continue;
+            }
+            try { std::rethrow_exception(x); }
+            catch (const std::exception& e) { result.push_back(e.what()); }
+            catch (...) { result.push_back("unknown error"); }
+        }
+        return result;
+    }
+
+    // {"cabinet"} or {"workspace"} updates that one, no parameter updates every cabinet
+    nlohmann::json Server::Update(const nlohmann::json& params) {
+        if (params.contains("workspace")) mHouse.UpdateWorkspace(StringParam(params, "workspace"));
+        else if (params.contains("cabinet")) mHouse.UpdateCabinet(StringParam(params, "cabinet"));
+        else mHouse.UpdateCabinets();
+        return nullptr;
+    }
+
+    // {"name", "modules": [{"name", "inTree"}], "mode", "dryRun"}, answers with the reconciliation plan
+    nlohmann::json Server::Checkout(const nlohmann::json& params) {
+        Manager::Warehouse::CheckoutArgs args{StringParam(params, "name"), {}, ModeParam(params)};
+        const auto modules = params.find("modules");
+        if (modules==params.end() || !modules->is_array()) throw RpcError(ErrInvalidParams, "Missing module list");
+        for (auto&& x : *modules) {
+            if (x.is_string()) args.Modules.push_back({x.get<std::string>()});
+            else args.Modules.push_back({StringParam(x, "name"), x.value("inTree", true)});
+        }
+        auto result = nlohmann::json::array();
+        for (auto&& x : mHouse.ReconcileWorkspace(args, params.value("dryRun", false))) result.push_back(StepOf(x));
+        return result;
+    }
+
+    // queries only read the published view, they may run while the writer changes the warehouse
+    nlohmann::json Server::List(const nlohmann::json&) {
+        const auto view = mHouse.View();
+        auto cabinets = nlohmann::json::object();
+        for (auto&& [ns, modules] : view->Cabinets) {
+            auto list = nlohmann::json::object();
+            for (auto&& [id, mod] : modules) {
+                list[id] = {
+                        {"uri", mod.Uri}, {"display", mod.Display}, {"full", mod.IsFull},
+                        {"lastUpdate", mod.LastUpdate.time_since_epoch().count()},
+                        {"lastCommit", mod.LastCommit.time_since_epoch().count()}
+                };
+            }
+            cabinets[ns] = std::move(list);
+        }
+        auto workspaces = nlohmann::json::array();
+        for (auto&& [name, _] : view->Workspaces) workspaces.push_back(name);
+        return {{"version", view->Version}, {"cabinets", std::move(cabinets)}, {"workspaces", std::move(workspaces)}};
+    }
+
+    // {"workspace"} reports on that workspace, no parameter on the warehouse as a whole
+    nlohmann::json Server::Status(const nlohmann::json& params) {
+        const auto view = mHouse.View();
+        if (params.contains("workspace")) {
+            const auto& name = StringParam(params, "workspace");
+            const auto ws = view->Workspaces.find(name);
+            if (ws==view->Workspaces.end()) throw RpcError(ErrInvalidParams, "No such workspace: "+name);
+            auto roots = nlohmann::json::object();
+            for (auto&& [mod, inTree] : ws->second.Roots) roots[mod] = {{"inTree", inTree}};
+            auto checkout = nlohmann::json::object();
+            for (auto&& [mod, path] : ws->second.Checkout) checkout[mod] = path.generic_string();
+            return {
+                    {"version", view->Version}, {"name", name}, {"roots", std::move(roots)},
+                    {"checkout", std::move(checkout)}, {"locked", ws->second.Locked}, {"stats", StatsOf(ws->second.Stats)}
+            };
+        }
+        std::size_t modules = 0;
+        for (auto&& [_, x] : view->Cabinets) modules += x.size();
+        // the caches and the lock table keep their own counters under their own locks
+        const auto builds = mHouse.BuildCacheStats();
+        const auto documents = Manager::Documents().Report();
+        const auto reserve = Utils::SehStats();
+        auto locks = nlohmann::json::object();
+        const auto waits = mHouse.Locks().Report();
+        for (std::size_t i = 0; i<waits.size(); ++i) {
+            const auto& x = waits[i];
+            locks[std::string(Manager::LockTable::NameOf(static_cast<Manager::LockTable::Scope>(i)))] = {
+                    {"acquired", x.Acquired}, {"contended", x.Contended},
+                    {"waitedNs", x.Waited.count()}, {"longestNs", x.Longest.count()}
+            };
+        }
+        return {
+                {"version", view->Version}, {"home", mHouse.Home().generic_string()}, {"cabinets", view->Cabinets.size()},
+                {"modules", modules}, {"workspaces", view->Workspaces.size()}, {"buildCache", {
+                        {"size", builds.Size}, {"entries", builds.Entries}, {"hits", builds.Hits},
+                        {"misses", builds.Misses}, {"evictions", builds.Evictions}
+                }}, {"documentCache", {
+                        {"size", documents.Size}, {"entries", documents.Entries}, {"hits", documents.Hits},
+                        {"misses", documents.Misses}, {"evictions", documents.Evictions}
+                }}, {"errorReserve", {
+                        {"inUse", reserve.InUse}, {"peak", reserve.Peak}, {"capacity", reserve.Capacity},
+                        {"allocations", reserve.Allocations}, {"failures", reserve.Failures}
+                }}, {"locks", std::move(locks)}
+        };
+    }
+
+#if !defined(_WIN32)
+    Server::Server(Manager::Warehouse& warehouse, std::filesystem::path socket)
+            :mHouse(warehouse), mSocket(std::move(socket)) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        const auto name = mSocket.string();
+        if (name.size()>=sizeof(address.sun_path)) throw std::runtime_error("Socket path too long: "+name);
+        std::memcpy(address.sun_path, name.c_str(), name.size()+1);
+        mListen = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (mListen<0) RaiseErrno("socket");
+        // a socket file nobody answers on is left over from a daemon that did not shut down cleanly
+        if (std::filesystem::exists(std::filesystem::symlink_status(mSocket))) {
+            if (connect(mListen, reinterpret_cast<sockaddr*>(&address), sizeof(address))==0) {
+                close(mListen);
+                throw std::runtime_error("Another daemon is serving on "+name);
+            }
+            std::filesystem::remove(mSocket);
+        }
+        if (bind(mListen, reinterpret_cast<sockaddr*>(&address), sizeof(address))<0 || listen(mListen, SOMAXCONN)<0) {
+            const auto err = errno;
+            close(mListen);
+            throw std::system_error(err, std::generic_category(), "bind");
+        }
+        fcntl(mListen, F_SETFL, fcntl(mListen, F_GETFL) | O_NONBLOCK);
+        // the writer pokes the serving thread through this pipe when an answer is ready
+        if (pipe2(mWake, O_NONBLOCK | O_CLOEXEC)<0) {
+            const auto err = errno;
+            close(mListen);
+            std::filesystem::remove(mSocket);
+            throw std::system_error(err, std::generic_category(), "pipe");
+        }
+        mWriter = std::thread([this]() { RunWriter(); });
+    }
+
+    Server::~Server() {
+        mStop = true;
+        mJobWake.notify_all();
+        mWriter.join();
+        for (auto&& x : mConnections) close(x.Fd);
+        close(mWake[0]);
+        close(mWake[1]);
+        close(mListen);
+        std::error_code ec{};
+        std::filesystem::remove(mSocket, ec);
+    }
+
+    void Server::Run() {
+        std::vector<pollfd> fds{};
+        while (!mStop) {
+            fds.clear();
+            const bool accepting = std::chrono::steady_clock::now()>=mAcceptResume;
+            fds.push_back({mListen, static_cast<short>(accepting ? POLLIN : 0), 0});
+            fds.push_back({mWake[0], POLLIN, 0});
+            for (auto&& x : mConnections) {
+                fds.push_back({x.Fd, static_cast<short>((x.Closing ? 0 : POLLIN) | (x.Out.empty() ? 0 : POLLOUT)), 0});
+            }
+            // wake up now and then to notice Stop
+            if (poll(fds.data(), fds.size(), 200)<0) {
+                if (errno==EINTR) continue;
+                RaiseErrno("poll");
+            }
+            if (fds[1].revents & POLLIN) {
+                char drain[256];
+                while (read(mWake[0], drain, sizeof(drain))>0) {}
+            }
+            for (std::size_t i = 2; i<fds.size(); ++i) {
+                auto& conn = mConnections[i-2];
+                if (fds[i].revents & (POLLERR | POLLNVAL)) {
+                    conn.Closing = true;
+                    conn.Out.clear();
+                    conn.Pending.clear();
+                }
+                else if (fds[i].revents & (POLLIN | POLLHUP)) Receive(conn);
+            }
+            for (auto&& conn : mConnections) {
+                // hand out finished answers, but never one before an earlier answer that is still being worked on
+                while (!conn.Pending.empty() && conn.Pending.front()->Ready) {
+                    if (auto& text = conn.Pending.front()->Text; !text.empty()) (conn.Out += text) += '\n';
+                    conn.Pending.pop_front();
+                }
+                if (!conn.Out.empty()) Send(conn);
+            }
+            mConnections.erase(std::remove_if(mConnections.begin(), mConnections.end(), [](const Connection& x) {
+                if (x.Closing && x.Out.empty() && x.Pending.empty()) return close(x.Fd), true;
+                return false;
+            }), mConnections.end());
+            if (fds[0].revents & POLLIN) Accept();
+        }
+    }
+
+    void Server::Accept() {
+        for (;;) {
+            const auto fd = accept4(mListen, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd<0) {
+                // the connection stays queued, leave it there until some descriptors are closed
+                if (errno==EMFILE || errno==ENFILE || errno==ENOBUFS || errno==ENOMEM) {
+                    mAcceptResume = std::chrono::steady_clock::now()+AcceptBackoff;
+                }
+                return;
+            }
+            mConnections.emplace_back(fd);
+        }
+    }
+
+    void Server::Receive(Connection& conn) {
+        char buffer[65536];
+        for (;;) {
+            const auto size = read(conn.Fd, buffer, sizeof(buffer));
+            if (size>0) {
+                conn.In.append(buffer, static_cast<std::size_t>(size));
+                continue;
+            }
+            if (size<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) break;
+            if (size<0 && errno==EINTR) continue;
+            // the client is done sending, answer what it asked for and let go
+            conn.Closing = true;
+            break;
+        }
+        // every complete line is one request, pipelined requests are answered in order
+        std::size_t begin = 0;
+        for (auto end = conn.In.find('\n'); end!=std::string::npos; end = conn.In.find('\n', begin)) {
+            auto line = conn.In.substr(begin, end-begin);
+            begin = end+1;
+            if (line.find_first_not_of(" \t\r")==std::string::npos) continue;
+            Submit(conn, std::move(line));
+        }
+        conn.In.erase(0, begin);
+        if (conn.In.size()>MaxLineLength) {
+            conn.In.clear();
+            const auto reply = conn.Pending.emplace_back(std::make_shared<Reply>());
+            reply->Text = ErrorOf(nullptr, ErrInvalidRequest, "Request too long").dump();
+            reply->Ready = true;
+            conn.Closing = true;
+        }
+    }
+
+    void Server::Submit(Connection& conn, std::string line) {
+        // a query behind a change of the same client has to see that change, so it waits its turn at the writer
+        const auto waiting = std::any_of(conn.Pending.begin(), conn.Pending.end(), [](auto& x) { return !x->Ready; });
+        const auto reply = conn.Pending.emplace_back(std::make_shared<Reply>());
+        if (!waiting && IsQuery(line)) {
+            reply->Text = Handle(line);
+            reply->Ready = true;
+            return;
+        }
+        {
+            std::lock_guard lk{mJobLock};
+            mJobs.emplace_back(std::move(line), reply);
+        }
+        mJobWake.notify_one();
+    }
+
+    void Server::RunWriter() {
+        std::unique_lock lk{mJobLock};
+        while (!mStop) {
+            // Stop may come from a signal handler, which cannot notify, so look at the flag now and then
+            if (!mJobWake.wait_for(lk, std::chrono::milliseconds(200), [this]() { return mStop || !mJobs.empty(); })) continue;
+            if (mStop) return;
+            const auto [line, reply] = std::move(mJobs.front());
+            mJobs.pop_front();
+            lk.unlock();
+            try { reply->Text = Handle(line); }
+            catch (...) { reply->Text = ErrorOf(nullptr, ErrServer, "Unknown error").dump(); }
+            reply->Ready = true;
+            [[maybe_unused]] const auto poked = write(mWake[1], "", 1);
+            lk.lock();
+        }
+    }
+
+    void Server::Send(Connection& conn) {
+        while (!conn.Out.empty()) {
+            const auto size = send(conn.Fd, conn.Out.data(), conn.Out.size(), MSG_NOSIGNAL);
+            if (size>0) {
+                conn.Out.erase(0, static_cast<std::size_t>(size));
+                continue;
+            }
+            if (size<0 && errno==EINTR) continue;
+            // a client that stopped reading does not get the rest
+            if (size<0 && errno!=EAGAIN && errno!=EWOULDBLOCK) conn.Out.clear(), conn.Pending.clear(), conn.Closing = true;
+            return;
+        }
+    }
+#else
+    Server::Server(Manager::Warehouse& warehouse, std::filesystem::path socket)
+            :mHouse(warehouse), mSocket(std::move(socket)) {
+        throw std::runtime_error("Daemon mode is not supported on this platform");
+    }
+
+    Server::~Server() = default;
+    void Server::Run() {}
+    void Server::Accept() {}
+    void Server::Receive(Connection&) {}
+    void Server::Send(Connection&) {}
+    void Server::Submit(Connection&, std::string) {}
+    void Server::RunWriter() {}
+#endif
+}
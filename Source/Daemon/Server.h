@@ -0,0 +1,73 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <filesystem>
+#include <condition_variable>
+#include "Json/Json.h"
+#include "Manager/Manager.h"
+
+namespace Configure::Daemon {
+    // Keeps a warehouse resident and serves it over a local stream socket.
+    // Requests and responses are JSON-RPC 2.0 objects, one per line. A client may send any number of requests without
+    // waiting, they are answered in the order they came in. Requests that change the warehouse run one after another
+    // on a writer thread. Queries are answered right away from the last published view, also while a change runs.
+    class Server {
+    public:
+        Server(Manager::Warehouse& warehouse, std::filesystem::path socket);
+        Server(const Server&) = delete;
+        Server& operator=(const Server&) = delete;
+        ~Server();
+        // Serves until Stop is called
+        void Run();
+        // Safe to call from another thread or a signal handler
+        void Stop() noexcept { mStop = true; }
+        // Answer to one request line, empty if nothing is to be sent back.
+        // Requests that change the warehouse must not be handled on two threads at once
+        [[nodiscard]] std::string Handle(const std::string& line);
+    private:
+        struct Reply {
+            std::atomic_bool Ready{false};
+            std::string Text;
+        };
+
+        struct Connection {
+            explicit Connection(int fd) noexcept: Fd(fd) {}
+            int Fd;
+            std::string In, Out;
+            bool Closing{false};
+            // answers in request order, some of them still being worked on by the writer
+            std::deque<std::shared_ptr<Reply>> Pending;
+        };
+
+        [[nodiscard]] nlohmann::json Dispatch(const nlohmann::json& request);
+        [[nodiscard]] nlohmann::json Call(const std::string& method, const nlohmann::json& params);
+        [[nodiscard]] nlohmann::json Import(const nlohmann::json& params);
+        [[nodiscard]] nlohmann::json Update(const nlohmann::json& params);
+        [[nodiscard]] nlohmann::json Checkout(const nlohmann::json& params);
+        [[nodiscard]] nlohmann::json List(const nlohmann::json& params);
+        [[nodiscard]] nlohmann::json Status(const nlohmann::json& params);
+        void Accept();
+        void Receive(Connection& conn);
+        void Send(Connection& conn);
+        void Submit(Connection& conn, std::string line);
+        void RunWriter();
+        Manager::Warehouse& mHouse;
+        std::filesystem::path mSocket;
+        int mListen{-1}, mWake[2]{-1, -1};
+        // accepting is paused until then after running out of descriptors
+        std::chrono::steady_clock::time_point mAcceptResume{};
+        std::atomic_bool mStop{false};
+        std::vector<Connection> mConnections;
+        std::mutex mJobLock;
+        std::condition_variable mJobWake;
+        std::deque<std::pair<std::string, std::shared_ptr<Reply>>> mJobs;
+        std::thread mWriter;
+    };
+}
@@ -27,6 +27,23 @@ namespace Git2 {
 
     static void Guard(int code) { if (code != 0) Exception::Raise(code); }
 
+    std::string Hash(std::string_view data) {
+        git_oid oid;
+        Guard(git_odb_hash(&oid, data.data(), data.size(), GIT_OBJECT_BLOB));
+        char buffer[GIT_OID_HEXSZ + 1];
+        return git_oid_tostr(buffer, sizeof(buffer), &oid);
+    }
+
+    Repository& Repository::operator=(Repository&& other) noexcept {
+        if (this != &other) {
+            git_repository_free(mHandle);
+            mHandle = std::exchange(other.mHandle, nullptr);
+        }
+        return *this;
+    }
+
+    Repository::~Repository() { git_repository_free(mHandle); }
+
     Repository Repository::Open(const std::filesystem::path &path) {
         const auto abs = std::filesystem::absolute(path);
         Repository result{};
@@ -73,6 +90,31 @@ namespace Git2 {
         Fn fn;
     };
 
+    void Repository::Track(const std::string &uri, const std::string &origin) {
+        git_remote *remote = nullptr;
+        git_config *config = nullptr;
+        git_buf branch = GIT_BUF_INIT;
+        const auto fin = Finally([&]() noexcept {
+            git_buf_dispose(&branch);
+            git_config_free(config);
+            git_remote_free(remote);
+        });
+        if (const auto error = git_remote_lookup(&remote, mHandle, origin.c_str()); error == GIT_ENOTFOUND)
+            Guard(git_remote_create(&remote, mHandle, origin.c_str(), uri.c_str()));
+        else Guard(error);
+        /* A born HEAD is already on the branch it follows */
+        if (git_repository_head_unborn(mHandle) != 1) return;
+        /* Ask the remote for the branch its HEAD is on */
+        Guard(git_remote_connect(remote, GIT_DIRECTION_FETCH, nullptr, nullptr, nullptr));
+        Guard(git_remote_default_branch(&branch, remote));
+        const std::string ref{branch.ptr, branch.size};
+        const auto name = ref.substr(ref.find('/', ref.find('/') + 1) + 1);
+        Guard(git_repository_set_head(mHandle, ref.c_str()));
+        Guard(git_repository_config(&config, mHandle));
+        Guard(git_config_set_string(config, ("branch." + name + ".remote").c_str(), origin.c_str()));
+        Guard(git_config_set_string(config, ("branch." + name + ".merge").c_str(), ref.c_str()));
+    }
+
     static void FastForward(git_repository *repo, const git_oid *target_oid, int is_unborn) {
         git_checkout_options ff_checkout_options = GIT_CHECKOUT_OPTIONS_INIT;
         git_reference *target_ref = nullptr;
@@ -225,4 +267,112 @@ namespace Git2 {
             CreateMergeCommit(mHandle, index, {nullptr, heads, 1, &sign});
         }
     }
+
+    git_time_t Repository::HeadCommitTime() {
+        git_reference *head = nullptr;
+        git_commit *commit = nullptr;
+        const auto fin = Finally([&]() noexcept {
+            git_commit_free(commit);
+            git_reference_free(head);
+        });
+        Guard(git_repository_head(&head, mHandle));
+        Guard(git_reference_peel(reinterpret_cast<git_object **>(&commit), head, GIT_OBJECT_COMMIT));
+        return git_commit_time(commit);
+    }
+
+    std::string Repository::HeadOid() {
+        git_oid oid;
+        Guard(git_reference_name_to_id(&oid, mHandle, "HEAD"));
+        char buffer[GIT_OID_HEXSZ + 1];
+        return git_oid_tostr(buffer, sizeof(buffer), &oid);
+    }
+
+    bool Repository::Contains(const std::string &oid) {
+        git_oid id;
+        if (git_oid_fromstr(&id, oid.c_str()) != 0) return false;
+        git_odb *odb = nullptr;
+        const auto fin = Finally([&]() noexcept { git_odb_free(odb); });
+        Guard(git_repository_odb(&odb, mHandle));
+        return git_odb_exists(odb, &id) == 1;
+    }
+
+    std::string Repository::TreeOf(const std::string &commit) {
+        git_oid id;
+        git_commit *object = nullptr;
+        const auto fin = Finally([&]() noexcept { git_commit_free(object); });
+        Guard(git_oid_fromstr(&id, commit.c_str()));
+        Guard(git_commit_lookup(&object, mHandle, &id));
+        char buffer[GIT_OID_HEXSZ + 1];
+        return git_oid_tostr(buffer, sizeof(buffer), git_commit_tree_id(object));
+    }
+
+    static bool Clean(git_repository *repo) {
+        git_status_list *list = nullptr;
+        const auto fin = Finally([&]() noexcept { git_status_list_free(list); });
+        git_status_options options = GIT_STATUS_OPTIONS_INIT;
+        options.flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED | GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS;
+        Guard(git_status_list_new(&list, repo, &options));
+        return git_status_list_entrycount(list) == 0;
+    }
+
+    bool Repository::IsClean() { return Clean(mHandle); }
+
+    bool Repository::IsCleanAt(const std::filesystem::path &tree) {
+        git_repository *other = nullptr;
+        const auto fin = Finally([&]() noexcept { git_repository_free(other); });
+        /* A handle of its own, this one keeps its work tree */
+        Guard(git_repository_open(&other, git_repository_path(mHandle)));
+        const auto abs = std::filesystem::absolute(tree).generic_string();
+        Guard(git_repository_set_workdir(other, abs.c_str(), 0));
+        return Clean(other);
+    }
+
+    void Repository::CheckoutTo(const std::string &commit, const std::filesystem::path &target) {
+        git_oid id;
+        git_commit *object = nullptr;
+        git_tree *tree = nullptr;
+        const auto fin = Finally([&]() noexcept {
+            git_tree_free(tree);
+            git_commit_free(object);
+        });
+        Guard(git_oid_fromstr(&id, commit.c_str()));
+        Guard(git_commit_lookup(&object, mHandle, &id));
+        Guard(git_commit_tree(&tree, object));
+        /* Write the tree out into a foreign directory, leaving HEAD, the index and the work tree untouched */
+        const auto abs = std::filesystem::absolute(target).generic_string();
+        std::filesystem::create_directories(abs);
+        git_checkout_options options = GIT_CHECKOUT_OPTIONS_INIT;
+        options.checkout_strategy = GIT_CHECKOUT_FORCE | GIT_CHECKOUT_DONT_UPDATE_INDEX;
+        options.target_directory = abs.c_str();
+        Guard(git_checkout_tree(mHandle, reinterpret_cast<git_object *>(tree), &options));
+    }
+
+    std::string Repository::BlobAt(const std::string &commit, const std::string &path) {
+        git_oid id;
+        git_commit *object = nullptr;
+        git_tree *tree = nullptr;
+        git_tree_entry *entry = nullptr;
+        const auto fin = Finally([&]() noexcept {
+            git_tree_entry_free(entry);
+            git_tree_free(tree);
+            git_commit_free(object);
+        });
+        Guard(git_oid_fromstr(&id, commit.c_str()));
+        Guard(git_commit_lookup(&object, mHandle, &id));
+        Guard(git_commit_tree(&tree, object));
+        if (const auto error = git_tree_entry_bypath(&entry, tree, path.c_str()); error == GIT_ENOTFOUND) return {};
+        else Guard(error);
+        if (git_tree_entry_type(entry) != GIT_OBJECT_BLOB) return {};
+        char buffer[GIT_OID_HEXSZ + 1];
+        return git_oid_tostr(buffer, sizeof(buffer), git_tree_entry_id(entry));
+    }
+
+    std::string Repository::ReadBlob(const std::string &oid) {
+        git_oid id;
+        git_blob *blob = nullptr;
+        const auto fin = Finally([&]() noexcept { git_blob_free(blob); });
+        Guard(git_oid_fromstr(&id, oid.c_str()));
+        Guard(git_blob_lookup(&blob, mHandle, &id));
+        return {static_cast<const char *>(git_blob_rawcontent(blob)), static_cast<std::size_t>(git_blob_rawsize(blob))};
+    }
 }
@@ -2,6 +2,8 @@
 
 #include "git2.h"
 #include <string>
+#include <utility>
+#include <string_view>
 #include <stdexcept>
 #include <filesystem>
 
@@ -21,14 +23,39 @@ namespace Git2 {
 	    std::string Email;
 	};
 
+	// Hex id of data hashed as a git blob
+	[[nodiscard]] std::string Hash(std::string_view data);
+
+	// Owns its handle, which holds open pack files and maps until the repository goes out of scope
 	class Repository {
 	public:
+		Repository(Repository&& other) noexcept : mHandle(std::exchange(other.mHandle, nullptr)) {}
+		Repository& operator=(Repository&& other) noexcept;
+		Repository(const Repository&) = delete;
+		Repository& operator=(const Repository&) = delete;
+		~Repository();
 		static Repository Open(const std::filesystem::path& path);
 		static Repository Create(const std::filesystem::path& path, bool isBare = false);
 		static Repository Clone(const std::filesystem::path& path, const std::string& uri);
 		void Fetch(const std::string& origin = "origin");
+		// Adds the remote if the repository does not have it yet and points an unborn HEAD at the default branch of
+		// the remote, tracking it, so that PullAuto brings in what a clone would have checked out
+		void Track(const std::string& uri, const std::string& origin = "origin");
 		void PullAuto(const UserSignature &sign, const std::string &origin = "origin");
+		[[nodiscard]] git_time_t HeadCommitTime();
+		[[nodiscard]] std::string HeadOid();
+		[[nodiscard]] bool Contains(const std::string& oid);
+		[[nodiscard]] std::string TreeOf(const std::string& commit);
+		// id of the blob at the path in the tree of the commit, empty if there is no file there
+		[[nodiscard]] std::string BlobAt(const std::string& commit, const std::string& path);
+		[[nodiscard]] std::string ReadBlob(const std::string& oid);
+		// true if the work tree has neither changes against HEAD nor untracked files
+		[[nodiscard]] bool IsClean();
+		// the same for a copy of the work tree elsewhere, which is compared against the index and HEAD of this one
+		[[nodiscard]] bool IsCleanAt(const std::filesystem::path& tree);
+		void CheckoutTo(const std::string& commit, const std::filesystem::path& target);
 	private:
-		git_repository* mHandle;
+		Repository() noexcept = default;
+		git_repository* mHandle{nullptr};
 	};
 }
\ No newline at end of file
@@ -1,18 +1,67 @@
 #pragma once
 
 #include "nlohmann/json.hpp"
+#include <string>
 #include <fstream>
+#include <iterator>
+#include <filesystem>
+#include <string_view>
+#include "Utils/File.h"
 
 namespace Json {
+	enum class Format {
+		Pretty, // indented text, for files people read and edit
+		Compact, // text without any whitespace
+		Cbor, // binary, for state only this program reads
+		MsgPack // binary, for state only this program reads
+	};
+
+	// Documents are objects at the top level. That tells the encodings apart by their first byte:
+	// a CBOR map starts with 0xa0-0xbf, a MessagePack map with 0x80-0x8f, 0xde or 0xdf, text with neither
+	inline nlohmann::json::input_format_t FormatOf(std::string_view data) noexcept {
+		if (data.empty()) return nlohmann::json::input_format_t::json;
+		const auto lead = static_cast<unsigned char>(data.front());
+		if (lead >= 0xa0 && lead <= 0xbf) return nlohmann::json::input_format_t::cbor;
+		if ((lead >= 0x80 && lead <= 0x8f) || lead == 0xde || lead == 0xdf) return nlohmann::json::input_format_t::msgpack;
+		return nlohmann::json::input_format_t::json;
+	}
+
+	inline nlohmann::json Parse(std::string_view data) {
+		switch (FormatOf(data)) {
+		case nlohmann::json::input_format_t::cbor:
+			return nlohmann::json::from_cbor(data.begin(), data.end());
+		case nlohmann::json::input_format_t::msgpack:
+			return nlohmann::json::from_msgpack(data.begin(), data.end());
+		default:
+			return nlohmann::json::parse(data.begin(), data.end());
+		}
+	}
+
 	inline nlohmann::json Load(const std::filesystem::path& file) {
-		nlohmann::json list{};
-		std::ifstream stream{ file };
-		stream >> list;
-		return list;
+		std::ifstream stream{ file, std::ios::binary };
+		const std::string data{ std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>() };
+		return Parse(data);
+	}
+
+	inline std::string Dump(const nlohmann::json& json, Format format = Format::Pretty) {
+		switch (format) {
+		case Format::Compact:
+			return json.dump();
+		case Format::Cbor: {
+			const auto data = nlohmann::json::to_cbor(json);
+			return { data.begin(), data.end() };
+		}
+		case Format::MsgPack: {
+			const auto data = nlohmann::json::to_msgpack(json);
+			return { data.begin(), data.end() };
+		}
+		default:
+			return json.dump(4) + '\n';
+		}
 	}
 
-	inline void Save(const std::filesystem::path& file, const nlohmann::json& json) {
-		std::ofstream stream{ file };
-		stream << std::setw(4) << json << std::endl;
+	// The file is replaced as a whole, a crash leaves either the old or the new content behind
+	inline void Save(const std::filesystem::path& file, const nlohmann::json& json, Format format = Format::Pretty) {
+		Utils::WriteAtomic(file, Dump(json, format));
 	}
 }
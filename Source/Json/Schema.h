@@ -0,0 +1,300 @@
+#pragma once
+
+#include <array>
+#include <tuple>
+#include <string>
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <utility>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include "Json.h"
+#include "Utils/Time.h"
+
+namespace Json::Schema {
+	// One key of a JSON object bound to the struct member its value is kept in
+	template <class T, class M>
+	struct Field {
+		std::string_view Key;
+		M T::* Member;
+	};
+
+	template <class T, class M>
+	constexpr Field<T, M> Bind(std::string_view key, M T::* member) noexcept { return { key, member }; }
+
+	// Specialized for each struct stored as a JSON object, with a constexpr tuple of Bind results named Fields.
+	// Members may be std::string, Utils::UnixTime, std::vector<std::string>, a string to string map as a vector of
+	// pairs, another struct with a schema or a vector of those, and an optional of a string or a time.
+	// Keys not in the schema are skipped
+	template <class T> struct Of;
+
+	// Hash table without collisions over a fixed set of keys, built while compiling.
+	// The seed of the hash is tried upwards until every key lands in a slot of its own
+	template <std::size_t N>
+	class KeyTable {
+	public:
+		constexpr explicit KeyTable(const std::array<std::string_view, N>& keys) noexcept : mKeys(keys) {
+			while (!Build()) ++mSeed;
+		}
+
+		// position of the key in the set, -1 if it is not one of them
+		[[nodiscard]] constexpr int Find(std::string_view key) const noexcept {
+			const auto slot = mSlots[Hash(key, mSeed) % Size];
+			return slot && mKeys[slot - 1] == key ? slot - 1 : -1;
+		}
+	private:
+		static constexpr std::size_t Size = N * 2 + 1;
+
+		static constexpr std::uint32_t Hash(std::string_view key, std::uint32_t seed) noexcept {
+			std::uint32_t hash = 2166136261u ^ seed;
+			for (const char c : key) hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+			return hash;
+		}
+
+		constexpr bool Build() noexcept {
+			for (auto& x : mSlots) x = 0;
+			for (std::size_t i = 0; i < N; ++i) {
+				auto& slot = mSlots[Hash(mKeys[i], mSeed) % Size];
+				if (slot) return false;
+				slot = static_cast<int>(i + 1);
+			}
+			return true;
+		}
+
+		std::array<std::string_view, N> mKeys;
+		std::array<int, Size> mSlots{};
+		std::uint32_t mSeed{ 0 };
+	};
+
+	template <class T>
+	constexpr auto KeysOf = std::apply([](auto&... fields) {
+		return KeyTable<sizeof...(fields)>({ fields.Key... });
+	}, Of<T>::Fields);
+
+	// Calls fn with the field at the position, nothing happens for a position out of range
+	template <class Tuple, class Fn, std::size_t... I>
+	void VisitAt(const Tuple& fields, int index, Fn&& fn, std::index_sequence<I...>) {
+		(void)((index == static_cast<int>(I) ? (fn(std::get<I>(fields)), true) : false) || ...);
+	}
+
+	template <class T, class Fn>
+	void VisitAt(int index, Fn&& fn) {
+		constexpr auto count = std::tuple_size_v<std::decay_t<decltype(Of<T>::Fields)>>;
+		VisitAt(Of<T>::Fields, index, std::forward<Fn>(fn), std::make_index_sequence<count>());
+	}
+
+	// Decoding steps of one member type, left empty where the type does not take the event.
+	// The decoder drives them from the parser events, an event no step takes is skipped with its whole subtree
+	struct Codec;
+
+	struct Frame {
+		void* Target{ nullptr };
+		const Codec* Steps{ nullptr };
+	};
+
+	struct Codec {
+		// value under the key of an object
+		Frame (*Slot)(void* self, std::string_view key);
+		// next object of an array
+		Frame (*Next)(void* self);
+		// next string of an array
+		void (*Append)(void* self, std::string& value);
+		// a string value, key is the one it came under
+		void (*Assign)(void* self, std::string& key, std::string& value);
+		// an integer value
+		void (*Number)(void* self, std::int64_t value);
+	};
+
+	template <class T> struct Codecs;
+
+	template <class T>
+	Frame SlotOf(void* self, std::string_view key) {
+		Frame result{};
+		VisitAt<T>(KeysOf<T>.Find(key), [&](auto& field) {
+			auto& member = static_cast<T*>(self)->*field.Member;
+			result = { &member, &Codecs<std::decay_t<decltype(member)>>::Value };
+		});
+		return result;
+	}
+
+	template <class T>
+	struct Codecs {
+		static constexpr Codec Value{ &SlotOf<T>, nullptr, nullptr, nullptr, nullptr };
+	};
+
+	template <>
+	struct Codecs<std::string> {
+		static constexpr Codec Value{ nullptr, nullptr, nullptr, [](void* self, std::string&, std::string& value) {
+			*static_cast<std::string*>(self) = std::move(value);
+		}, nullptr };
+	};
+
+	template <>
+	struct Codecs<std::optional<std::string>> {
+		static constexpr Codec Value{ nullptr, nullptr, nullptr, [](void* self, std::string&, std::string& value) {
+			*static_cast<std::optional<std::string>*>(self) = std::move(value);
+		}, nullptr };
+	};
+
+	// epoch seconds, or the text times were stored as before, which is read over into seconds
+	template <>
+	struct Codecs<std::optional<Utils::UnixTime>> {
+		static constexpr Codec Value{ nullptr, nullptr, nullptr, [](void* self, std::string&, std::string& value) {
+			if (const auto seconds = Utils::ParseLegacyTime(value); seconds) *static_cast<std::optional<Utils::UnixTime>*>(self) = Utils::UnixTime{ *seconds };
+		}, [](void* self, std::int64_t value) {
+			*static_cast<std::optional<Utils::UnixTime>*>(self) = Utils::UnixTime{ value };
+		} };
+	};
+
+	template <>
+	struct Codecs<std::vector<std::string>> {
+		static constexpr Codec Value{ nullptr, nullptr, [](void* self, std::string& value) {
+			static_cast<std::vector<std::string>*>(self)->push_back(std::move(value));
+		}, nullptr, nullptr };
+	};
+
+	using StringMap = std::vector<std::pair<std::string, std::string>>;
+
+	// each key of the map object comes back here, its value is taken as the entry
+	struct MapEntry {
+		static constexpr Codec Value{ nullptr, nullptr, nullptr, [](void* self, std::string& key, std::string& value) {
+			static_cast<StringMap*>(self)->emplace_back(std::move(key), std::move(value));
+		}, nullptr };
+	};
+
+	template <>
+	struct Codecs<StringMap> {
+		static constexpr Codec Value{ [](void* self, std::string_view) { return Frame{ self, &MapEntry::Value }; }, nullptr, nullptr, nullptr, nullptr };
+	};
+
+	template <class T>
+	struct Codecs<std::vector<T>> {
+		static constexpr Codec Value{ nullptr, [](void* self) {
+			return Frame{ &static_cast<std::vector<T>*>(self)->emplace_back(), &Codecs<T>::Value };
+		}, nullptr, nullptr, nullptr };
+	};
+
+	// Parser event sink filling a struct through its schema, no document is built in between
+	template <class T>
+	class Decoder {
+	public:
+		explicit Decoder(T& target) noexcept : mRoot{ &target, &Codecs<T>::Value } {}
+
+		bool null() noexcept { return Skip(); }
+		bool boolean(bool) noexcept { return Skip(); }
+		bool number_integer(nlohmann::json::number_integer_t value) { return Number(value); }
+		bool number_unsigned(nlohmann::json::number_unsigned_t value) {
+			return value <= static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max()) ? Number(static_cast<std::int64_t>(value)) : Skip();
+		}
+		bool number_float(nlohmann::json::number_float_t, const nlohmann::json::string_t&) noexcept { return Skip(); }
+
+		bool string(nlohmann::json::string_t& value) {
+			if (mLevels.empty()) return true;
+			const auto& top = mLevels.back();
+			if (top.Array) {
+				if (top.At.Steps && top.At.Steps->Append) top.At.Steps->Append(top.At.Target, value);
+			}
+			else if (mPending.Steps && mPending.Steps->Assign) mPending.Steps->Assign(mPending.Target, mKey, value);
+			return Skip();
+		}
+
+		bool key(nlohmann::json::string_t& key) {
+			const auto& top = mLevels.back().At;
+			mKey = std::move(key);
+			mPending = top.Steps && top.Steps->Slot ? top.Steps->Slot(top.Target, mKey) : Frame{};
+			return true;
+		}
+
+		bool start_object(std::size_t) { return Enter(false); }
+		bool start_array(std::size_t) { return Enter(true); }
+		bool end_object() noexcept { return mLevels.pop_back(), true; }
+		bool end_array() noexcept { return mLevels.pop_back(), true; }
+
+		[[noreturn]] bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& e) {
+			throw std::runtime_error(e.what());
+		}
+	private:
+		struct Level {
+			Frame At;
+			bool Array;
+		};
+
+		bool Skip() noexcept { return mPending = {}, true; }
+
+		bool Number(std::int64_t value) {
+			if (!mLevels.empty() && !mLevels.back().Array && mPending.Steps && mPending.Steps->Number) mPending.Steps->Number(mPending.Target, value);
+			return Skip();
+		}
+
+		bool Enter(bool array) {
+			Frame next{};
+			if (mLevels.empty()) next = mRoot;
+			else if (const auto& top = mLevels.back(); top.Array) {
+				if (!array && top.At.Steps && top.At.Steps->Next) next = top.At.Steps->Next(top.At.Target);
+			}
+			else next = mPending;
+			mLevels.push_back({ next, array });
+			return Skip();
+		}
+
+		Frame mRoot, mPending;
+		std::string mKey;
+		std::vector<Level> mLevels;
+	};
+
+	// Fills the struct from a document in any encoding Json::Load reads
+	template <class T>
+	void Decode(std::string_view data, T& target) {
+		Decoder<T> decoder{ target };
+		nlohmann::json::sax_parse(nlohmann::detail::input_adapter(data.data(), data.size()), &decoder, FormatOf(data));
+	}
+
+	template <class T>
+	[[nodiscard]] T Decode(std::string_view data) {
+		T result{};
+		Decode(data, result);
+		return result;
+	}
+
+	template <class T> struct IsOptional : std::false_type {};
+	template <class T> struct IsOptional<std::optional<T>> : std::true_type {};
+
+	template <class T>
+	[[nodiscard]] nlohmann::json Encode(const T& value);
+
+	inline nlohmann::json Encode(const std::string& value) { return value; }
+	inline nlohmann::json Encode(const Utils::UnixTime& value) { return value.Seconds; }
+	inline nlohmann::json Encode(const std::vector<std::string>& value) { return value; }
+
+	inline nlohmann::json Encode(const StringMap& value) {
+		auto result = nlohmann::json::object();
+		for (auto&& [key, x] : value) result[key] = x;
+		return result;
+	}
+
+	template <class T>
+	nlohmann::json Encode(const std::vector<T>& value) {
+		auto result = nlohmann::json::array();
+		for (auto&& x : value) result.push_back(Encode(x));
+		return result;
+	}
+
+	template <class T>
+	nlohmann::json Encode(const T& value) {
+		auto result = nlohmann::json::object();
+		std::apply([&](auto&... fields) {
+			const auto put = [&](auto& field) {
+				auto& member = value.*field.Member;
+				if constexpr (IsOptional<std::decay_t<decltype(member)>>::value) {
+					if (member) result[std::string(field.Key)] = Encode(*member);
+				}
+				else result[std::string(field.Key)] = Encode(member);
+			};
+			(put(fields), ...);
+		}, Of<T>::Fields);
+		return result;
+	}
+}
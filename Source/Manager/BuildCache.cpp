@@ -0,0 +1,128 @@
+#include "BuildCache.h"
+#include <vector>
+#include <algorithm>
+#include "Utils/File.h"
+#include "Git2/Repository.h"
+
+namespace Configure::Manager {
+    BuildCache::BuildCache(
+            std::filesystem::path home, std::filesystem::path temp, std::uintmax_t capacity,
+            LockTable& locks, std::function<std::unordered_set<std::string>()> linked
+    ): mHome(std::move(home)), mTemp(std::move(temp)), mCapacity(capacity), mLocks(locks), mLinked(std::move(linked)) {
+        std::filesystem::create_directories(mHome);
+        std::filesystem::create_directories(mTemp);
+        for (auto&& x : std::filesystem::directory_iterator(mHome)) {
+            if (!x.is_directory()) continue;
+            const auto size = Utils::TreeSize(x.path());
+            mSizes.insert_or_assign(x.path().filename().string(), size);
+            mStats.Size += size;
+        }
+    }
+
+    std::string BuildCache::Key(const std::string& tree, const std::string& closure, const std::string& toolchain) {
+        return Git2::Hash("tree "+tree+"\nclosure "+closure+"\ntoolchain "+toolchain+'\n');
+    }
+
+    std::optional<std::filesystem::path> BuildCache::Lookup(const std::string& key) {
+        std::lock_guard lk{mLock};
+        auto target = mHome/key;
+        if (!std::filesystem::exists(target)) {
+            ++mStats.Misses;
+            return std::nullopt;
+        }
+        // the modification time of an entry is its last use, which is what eviction goes by
+        std::filesystem::last_write_time(target, std::filesystem::file_time_type::clock::now());
+        if (mSizes.find(key)==mSizes.end()) {
+            // published by another process
+            const auto size = Utils::TreeSize(target);
+            mSizes.insert_or_assign(key, size);
+            mStats.Size += size;
+        }
+        ++mStats.Hits;
+        return target;
+    }
+
+    std::filesystem::path BuildCache::Stage(const std::string& key) {
+        auto stage = mTemp/Utils::UniqueName("Build-"+key);
+        std::filesystem::create_directories(stage);
+        return stage;
+    }
+
+    std::filesystem::path BuildCache::Publish(const std::filesystem::path& stage, const std::string& key) {
+        auto target = mHome/key;
+        const auto size = Utils::TreeSize(stage);
+        std::lock_guard lk{mLock};
+        // room is made before the entry goes in, an entry larger than the whole cache stays until the next publish
+        const auto known = mSizes.find(key)!=mSizes.end();
+        if (!known) Evict(key, size);
+        std::error_code ec{};
+        std::filesystem::rename(stage, target, ec);
+        if (ec) {
+            // someone else built the same inputs first, theirs is as good as ours
+            if (!std::filesystem::exists(target)) throw std::filesystem::filesystem_error("rename", stage, target, ec);
+            std::filesystem::remove_all(stage);
+        }
+        std::filesystem::last_write_time(target, std::filesystem::file_time_type::clock::now());
+        if (!known) {
+            const auto charge = ec ? Utils::TreeSize(target) : size;
+            mSizes.insert_or_assign(key, charge);
+            mStats.Size += charge;
+        }
+        return target;
+    }
+
+    void BuildCache::Drop(const std::string& key) {
+        std::lock_guard lk{mLock};
+        Remove(key);
+    }
+
+    void BuildCache::Remove(const std::string& key) {
+        const auto target = mHome/key;
+        if (std::filesystem::exists(target)) {
+            const auto trash = mTemp/Utils::UniqueName("Dropped-"+key);
+            std::filesystem::rename(target, trash);
+            std::filesystem::remove_all(trash);
+        }
+        if (const auto i = mSizes.find(key); i!=mSizes.end()) {
+            mStats.Size -= i->second;
+            mSizes.erase(i);
+        }
+    }
+
+    BuildCache::Stats BuildCache::Report() {
+        std::lock_guard lk{mLock};
+        auto result = mStats;
+        result.Entries = mSizes.size();
+        return result;
+    }
+
+    void BuildCache::Evict(const std::string& keep, const std::uintmax_t incoming) {
+        if (mStats.Size+incoming<=mCapacity) return;
+        std::vector<std::pair<std::filesystem::file_time_type, std::string>> entries{};
+        for (auto&& [key, _] : mSizes) {
+            if (key==keep) continue;
+            std::error_code ec{};
+            entries.emplace_back(std::filesystem::last_write_time(mHome/key, ec), key);
+        }
+        std::sort(entries.begin(), entries.end());
+        auto next = entries.begin();
+        while (mStats.Size+incoming>mCapacity && next!=entries.end()) {
+            // hold entries nobody is using until they would make enough room
+            std::vector<std::pair<std::string, Utils::FileLock>> held{};
+            std::uintmax_t freed = 0;
+            for (; next!=entries.end() && mStats.Size+incoming>mCapacity+freed; ++next) {
+                auto lock = mLocks.TryAcquire(LockTable::Scope::Build, next->second, Utils::FileLock::Exclusive);
+                if (!lock.Held()) continue;
+                freed += mSizes.at(next->second);
+                held.emplace_back(next->second, std::move(lock));
+            }
+            // links are only made under the shared lock, none can appear to the held entries from here on
+            const auto linked = mLinked();
+            for (auto&& [key, _] : held) {
+                if (linked.count(key)) continue;
+                Remove(key);
+                ++mStats.Evictions;
+            }
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <optional>
+#include <functional>
+#include <filesystem>
+#include <unordered_map>
+#include <unordered_set>
+#include "LockTable.h"
+
+namespace Configure::Manager {
+    // Build outputs keyed by the inputs that produced them.
+    // An entry is staged by the builder, published with one rename and then shared by every workspace with the same
+    // inputs. The least recently used entries are evicted once the cache grows past its capacity.
+    // Entries are looked up, published and linked under the shared build lock of their key. Eviction takes it
+    // exclusively and leaves alone whatever a workspace still links to.
+    class BuildCache {
+    public:
+        struct Stats {
+            std::uintmax_t Size{0}, Entries{0}, Hits{0}, Misses{0}, Evictions{0};
+        };
+
+        // linked lists the keys some workspace links to
+        BuildCache(
+                std::filesystem::path home, std::filesystem::path temp, std::uintmax_t capacity,
+                LockTable& locks, std::function<std::unordered_set<std::string>()> linked
+        );
+        // Key of a module build from the tree of the module, the hash of its dependency closure and the toolchain
+        [[nodiscard]] static std::string Key(const std::string& tree, const std::string& closure, const std::string& toolchain);
+        [[nodiscard]] std::optional<std::filesystem::path> Lookup(const std::string& key);
+        [[nodiscard]] std::filesystem::path Stage(const std::string& key);
+        std::filesystem::path Publish(const std::filesystem::path& stage, const std::string& key);
+        void Drop(const std::string& key);
+        [[nodiscard]] Stats Report();
+    private:
+        // makes room for incoming bytes, never evicting keep
+        void Evict(const std::string& keep, std::uintmax_t incoming);
+        void Remove(const std::string& key);
+        std::mutex mLock;
+        std::filesystem::path mHome, mTemp;
+        std::uintmax_t mCapacity;
+        LockTable& mLocks;
+        std::function<std::unordered_set<std::string>()> mLinked;
+        Stats mStats;
+        std::unordered_map<std::string, std::uintmax_t> mSizes;
+    };
+}
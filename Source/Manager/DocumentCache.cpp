@@ -0,0 +1,51 @@
+#include "DocumentCache.h"
+#include "InterOp.h"
+
+namespace Configure::Manager {
+    std::shared_ptr<const void> DocumentCache::Find(const std::string& key, const Utils::FileStamp& stamp) {
+        std::lock_guard lk{mLock};
+        const auto i = mEntries.find(key);
+        if (i==mEntries.end() || i->second.Stamp!=stamp) {
+            ++mStats.Misses;
+            return nullptr;
+        }
+        ++mStats.Hits;
+        mUses.splice(mUses.begin(), mUses, i->second.Use);
+        return i->second.Value;
+    }
+
+    void DocumentCache::Store(std::string key, const Utils::FileStamp& stamp, std::shared_ptr<const void> value) {
+        std::lock_guard lk{mLock};
+        const auto charge = stamp.Size+key.size();
+        // a file larger than the whole cache would only push everything else out
+        if (charge>mCapacity) return;
+        Drop(key);
+        mUses.push_front(key);
+        mEntries.insert_or_assign(std::move(key), Entry{stamp, charge, std::move(value), mUses.begin()});
+        mStats.Size += charge;
+        mStats.Entries = mEntries.size();
+        while (mStats.Size>mCapacity) {
+            Drop(mUses.back());
+            ++mStats.Evictions;
+        }
+    }
+
+    void DocumentCache::Drop(const std::string& key) {
+        const auto i = mEntries.find(key);
+        if (i==mEntries.end()) return;
+        mStats.Size -= i->second.Charge;
+        mUses.erase(i->second.Use);
+        mEntries.erase(i);
+        mStats.Entries = mEntries.size();
+    }
+
+    DocumentCache::Stats DocumentCache::Report() {
+        std::lock_guard lk{mLock};
+        return mStats;
+    }
+
+    DocumentCache& Documents() {
+        static DocumentCache cache{InterOp::DocumentCacheCapacity};
+        return cache;
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <typeinfo>
+#include <filesystem>
+#include <unordered_map>
+#include "Utils/File.h"
+
+namespace Configure::Manager {
+    // Parsed content of files, shared by everything in the process that reads them.
+    // An entry stands for one version of a file, told by its size, modification time and inode, and is parsed
+    // again once any of them changes. Entries are charged with the size of their file and key, the least recently used ones
+    // are dropped once the total grows past the capacity. Entries are immutable, they may be used from any thread.
+    class DocumentCache {
+    public:
+        struct Stats {
+            std::uintmax_t Size{0}, Entries{0}, Hits{0}, Misses{0}, Evictions{0};
+        };
+
+        explicit DocumentCache(std::uintmax_t capacity) noexcept: mCapacity(capacity) {}
+        DocumentCache(const DocumentCache&) = delete;
+        DocumentCache& operator=(const DocumentCache&) = delete;
+
+        // Content of the file as made by parse(file). Files of the same path read as different types are separate entries
+        template <class T, class Parse>
+        [[nodiscard]] std::shared_ptr<const T> Get(const std::filesystem::path& file, Parse parse) {
+            const auto stamp = Utils::StampOf(file);
+            // nothing to key a missing file on, let the parser report it
+            if (!stamp) return std::make_shared<const T>(parse(file));
+            auto key = std::string(typeid(T).name()).append(1, '\0').append(file.string());
+            if (auto hit = Find(key, *stamp)) return std::static_pointer_cast<const T>(std::move(hit));
+            auto value = std::make_shared<const T>(parse(file));
+            // a file replaced while it was read may have given a mix of both versions, do not keep that
+            if (Utils::StampOf(file)==stamp) Store(std::move(key), *stamp, value);
+            return value;
+        }
+
+        [[nodiscard]] Stats Report();
+    private:
+        struct Entry {
+            Utils::FileStamp Stamp;
+            std::uintmax_t Charge;
+            std::shared_ptr<const void> Value;
+            std::list<std::string>::iterator Use;
+        };
+
+        [[nodiscard]] std::shared_ptr<const void> Find(const std::string& key, const Utils::FileStamp& stamp);
+        void Store(std::string key, const Utils::FileStamp& stamp, std::shared_ptr<const void> value);
+        void Drop(const std::string& key);
+        std::mutex mLock;
+        std::uintmax_t mCapacity;
+        Stats mStats;
+        // most recently used first
+        std::list<std::string> mUses;
+        std::unordered_map<std::string, Entry> mEntries;
+    };
+
+    // The cache all metadata of the process is read through
+    [[nodiscard]] DocumentCache& Documents();
+}
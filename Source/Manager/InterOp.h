@@ -1,24 +1,49 @@
 #pragma once
 
 #include "Manager.h"
+#include "Json/Schema.h"
+#include "Utils/ErrorList.h"
+#include "Git2/Repository.h"
 
 namespace Configure::Manager::InterOp {
     // Path Notes
     constexpr std::string_view RepoPath{"Repo"};
+    constexpr std::string_view RepoPartialPath{"Repo.partial"};
     constexpr std::string_view InfoPath{"info.json"};
+    constexpr std::string_view WorkspaceStatePath{"info.cbor"};
+    constexpr std::string_view ManifestPath{"module.json"};
+    constexpr std::string_view LockPath{"lock.json"};
     constexpr std::string_view BuildPath{"BuildTree"};
     constexpr std::string_view ModulesPath{"Modules"};
     constexpr std::string_view WarehouseDir{".nwds"};
     constexpr std::string_view WarehouseTempDir{"Temp"};
     constexpr std::string_view WarehouseStockDir{"Stock"};
     constexpr std::string_view WarehouseWorkspaceDir{"Ws"};
-    constexpr std::string_view FetchProgressionTempDir{"FetchProgress"};
+    constexpr std::string_view WarehouseSnapshotDir{"Snapshots"};
+    constexpr std::string_view WarehouseLockDir{"Locks"};
+    constexpr std::string_view WarehousePartialDir{"Partial"};
+    constexpr std::string_view WarehouseManifestDir{"Manifests"};
+    // Entries of the temp directory younger than this may still be in use by another process
+    constexpr auto TempGracePeriod = std::chrono::hours(1);
+    // Shared build outputs are kept in .nwds/BuildTree up to this many bytes
+    constexpr std::uintmax_t BuildCacheCapacity = std::uintmax_t(16) * 1024 * 1024 * 1024;
+    // Imports left unfinished this long are given up by the collector, unless the warehouse is told otherwise
+    constexpr auto PartialImportExpiry = std::chrono::hours(72);
+    // Cabinets of one batch import fetched at the same time
+    constexpr std::size_t ImportConcurrency = 8;
+    // A pull that succeeded this recently stands in for another one on the same repository
+    constexpr auto PullCoalesceWindow = std::chrono::seconds(2);
+    // Parsed metadata files are kept in memory up to this many bytes of file content
+    constexpr std::uintmax_t DocumentCacheCapacity = std::uintmax_t(8) * 1024 * 1024;
+    constexpr std::string_view WarehouseJournalFile{"Journal"};
     // Messages
     constexpr std::string_view MsgCabinetCorrupted{"Cabinet Corrupted"};
     constexpr std::string_view MsgCabinetConflict{"Cabinet with the same name already exists"};
     constexpr std::string_view MsgModuleDirMissing{"Module Directory Missing"};
     constexpr std::string_view MsgModuleDirCorrupted{"Module Directory Corrupted"};
     constexpr std::string_view MsgModuleInfoCorrupted{"Module Internal Info File Corrupted"};
+    constexpr std::string_view MsgLockedRevisionMissing{"Locked revisions not available locally:"};
+    constexpr std::string_view MsgLockedRevisionUnknown{"Modules locked before they were fetched:"};
     // Id Key
     constexpr std::string_view KeyModuleInfoId{"id"};
     constexpr std::string_view KeyModuleInfoUri{"uri"};
@@ -26,6 +51,15 @@ namespace Configure::Manager::InterOp {
     constexpr std::string_view KeyModuleInfoLPull{"lup"};
     constexpr std::string_view KeyModuleInfoLCommit{"lcm"};
     constexpr std::string_view KeyCabinetNamespace{"ns"};
+    constexpr std::string_view KeyCabinetModules{"modules"};
+    constexpr std::string_view KeyManifestDepends{"depends"};
+    constexpr std::string_view KeyManifestImport{"import"};
+
+    // state file of a workspace directory, those written before the binary form still go by info.json
+    inline std::filesystem::path WorkspaceState(const std::filesystem::path& dir) {
+        if (!std::filesystem::exists(dir/WorkspaceStatePath) && std::filesystem::exists(dir/InfoPath)) return dir/InfoPath;
+        return dir/WorkspaceStatePath;
+    }
 
     inline void ValidateName(std::string_view view) {
         static constexpr std::string_view charNotAllowed{"#<$+%>!`&*'\"|{?=}/\\: @"};
@@ -34,11 +68,77 @@ namespace Configure::Manager::InterOp {
         }
     }
 
+    // Runs fn for one item of a batch. A failure is recorded into errors instead of being thrown, false if there was one
+    template <class Fn>
+    bool Attempt(Utils::ErrorList& errors, const std::string& target, std::string_view operation, Fn&& fn) {
+        const auto start = std::chrono::steady_clock::now();
+        const auto record = [&](std::string message, int code = 0, int klass = 0) {
+            errors.Add({target, operation, std::move(message), code, klass, std::chrono::steady_clock::now()-start});
+        };
+        try {
+            fn();
+            return true;
+        }
+        catch (const Git2::Exception& e) { record(e.what(), e.Code(), e.Klass()); }
+        catch (const std::exception& e) { record(e.what()); }
+        catch (...) { record("unknown error"); }
+        return false;
+    }
+
+    // Module index of a warehouse with the dependency resolution over it.
+    // Manifests are parsed at most once per index, so it is not safe to resolve through one index concurrently
+    class Resolver {
+    public:
+        using CheckoutMap = std::unordered_map<std::string, std::filesystem::path>;
+        using RootMap = Workspace::RootMap;
+        using PinMap = Workspace::PinMap;
+        explicit Resolver(Warehouse& warehouse);
+        [[nodiscard]] Module* Find(const std::string& name) const;
+        [[nodiscard]] CheckoutMap Resolve(const std::filesystem::path& home, const std::string& name, const RootMap& roots) const;
+        // direct dependencies of the module named in its manifest, limited to the modules known to the warehouse
+        [[nodiscard]] const std::vector<std::string>& Dependencies(const Module& mod) const;
+        // the same as of a commit of the module, read from its object database or the manifest store
+        [[nodiscard]] std::vector<std::string> Dependencies(const Module& mod, const std::string& commit) const;
+        // placement of an exact module set, as recorded in a lockfile, without looking at any manifest
+        [[nodiscard]] CheckoutMap Place(const std::filesystem::path& home, const std::string& name, const RootMap& roots, const PinMap& pins) const;
+    private:
+        [[nodiscard]] std::vector<std::string> Known(ModuleManifest manifest) const;
+        const ManifestStore* mManifests;
+        std::unordered_map<std::string, Module*> mIndex;
+        mutable std::unordered_map<const Module*, std::vector<std::string>> mDepends;
+    };
+
     [[noreturn]] inline void Corruption(std::string_view message) { throw std::runtime_error(message.data()); }
+}
+
+namespace Json::Schema {
+    template <>
+    struct Of<Configure::Manager::ModuleInfo> {
+        using T = Configure::Manager::ModuleInfo;
+        static constexpr auto Fields = std::make_tuple(
+                Bind(Configure::Manager::InterOp::KeyModuleInfoId, &T::Id),
+                Bind(Configure::Manager::InterOp::KeyModuleInfoUri, &T::Uri),
+                Bind(Configure::Manager::InterOp::KeyModuleInfoDisplay, &T::Display),
+                Bind(Configure::Manager::InterOp::KeyModuleInfoLPull, &T::LastPull),
+                Bind(Configure::Manager::InterOp::KeyModuleInfoLCommit, &T::LastCommit)
+        );
+    };
+
+    template <>
+    struct Of<Configure::Manager::CabinetInfo> {
+        using T = Configure::Manager::CabinetInfo;
+        static constexpr auto Fields = std::make_tuple(
+                Bind(Configure::Manager::InterOp::KeyCabinetNamespace, &T::Namespace),
+                Bind(Configure::Manager::InterOp::KeyCabinetModules, &T::Modules)
+        );
+    };
 
-    Workspace WorkspaceCheckoutHelper(
-            Warehouse& warehouse,
-            const std::filesystem::path& home,
-            const Warehouse::CheckoutArgs& args
-    );
+    template <>
+    struct Of<Configure::Manager::ModuleManifest> {
+        using T = Configure::Manager::ModuleManifest;
+        static constexpr auto Fields = std::make_tuple(
+                Bind(Configure::Manager::InterOp::KeyManifestDepends, &T::Depends),
+                Bind(Configure::Manager::InterOp::KeyManifestImport, &T::Import)
+        );
+    };
 }
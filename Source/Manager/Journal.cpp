@@ -0,0 +1,136 @@
+#include "Journal.h"
+#include "Json/Json.h"
+#include <chrono>
+#include <sstream>
+
+namespace {
+    // Number of distinct pending targets that triggers an early compaction
+    constexpr std::size_t CompactThreshold = 64;
+    // Upper bound of how long committed content stays in the journal only
+    constexpr auto CompactInterval = std::chrono::seconds(2);
+
+    std::string MakeRecord(const std::vector<std::pair<std::string, std::string>>& writes) {
+        auto list = nlohmann::json::array();
+        for (auto&& [target, content] : writes) list.push_back({target, content});
+        // the leading line break ends a record torn by a crashed writer, so it does not swallow this one
+        return '\n' + nlohmann::json{{"w", std::move(list)}}.dump() + '\n';
+    }
+}
+
+namespace Configure::Manager {
+    void Journal::Batch::Put(const std::filesystem::path& target, std::string content) {
+        mEntries.emplace_back(target, std::move(content));
+    }
+
+    Journal::Journal(const std::filesystem::path& file)
+            :mFile(std::filesystem::absolute(file)), mBase(mFile.parent_path()), mLockFile(mFile.string()+".lock") {
+        std::filesystem::create_directories(mBase);
+        // the file is only ever truncated in place, never replaced, so the handle stays good for the whole run
+        mStream = Utils::AppendFile(mFile);
+        {
+            const Utils::FileLock lock{mLockFile, Utils::FileLock::Exclusive};
+            Fold();
+        }
+        mCompactor = std::thread([this]() { RunCompaction(); });
+    }
+
+    Journal::~Journal() {
+        {
+            std::lock_guard lk{mLock};
+            mStop = true;
+        }
+        mWake.notify_all();
+        mCompactor.join();
+        try { Compact(); }
+        catch (...) {
+            // ignore, the records are still in the journal and will be folded by the next compaction or open
+        }
+    }
+
+    void Journal::Commit(Batch&& batch) {
+        if (batch.Empty()) return;
+        std::vector<std::pair<std::string, std::string>> writes{};
+        writes.reserve(batch.mEntries.size());
+        for (auto&& [target, content] : batch.mEntries) writes.emplace_back(Relative(target), std::move(content));
+        const auto record = MakeRecord(writes);
+        const Utils::FileLock lock{mLockFile, Utils::FileLock::Shared};
+        std::unique_lock lk{mLock};
+        mStream.Write(record);
+        mStream.Sync();
+        for (auto&& [target, _] : writes) mPending.insert(std::move(target));
+        const auto wake = mPending.size() >= CompactThreshold;
+        lk.unlock();
+        if (wake) mWake.notify_one();
+    }
+
+    void Journal::Compact() {
+        std::lock_guard compacting{mCompacting};
+        {
+            std::lock_guard lk{mLock};
+            if (mPending.empty()) return;
+        }
+        // commits finish their record under the shared lock, once we hold it exclusively the file is complete
+        const Utils::FileLock lock{mLockFile, Utils::FileLock::Exclusive};
+        Fold();
+        std::lock_guard lk{mLock};
+        mPending.clear();
+    }
+
+    void Journal::Fold() {
+        std::stringstream content{};
+        content << std::ifstream(mFile, std::ios::binary).rdbuf();
+        std::unordered_map<std::string, std::string> latest{};
+        std::string line{};
+        while (std::getline(content, line)) {
+            // a record without its line terminator was torn by a crash before its fsync
+            if (content.eof()) break;
+            if (line.empty()) continue;
+            try {
+                const auto record = nlohmann::json::parse(line);
+                for (auto&& x : record.at("w")) latest.insert_or_assign(x.at(0), x.at(1));
+            }
+            catch (...) {
+                // torn as well, records of other writers follow it
+            }
+        }
+        std::vector<std::pair<std::string, std::string>> retry{};
+        for (auto&& [target, data] : latest) {
+            const auto path = mBase/target;
+            // the file went away with its directory after it was committed, a module or cabinet removed since
+            if (!std::filesystem::is_directory(path.parent_path())) continue;
+            try {
+                Utils::WriteAtomic(path, data);
+            }
+            catch (...) {
+                retry.emplace_back(target, std::move(data));
+            }
+        }
+        mStream.Truncate();
+        // what could not be written stays for the next compaction, without holding up everything else
+        if (!retry.empty()) {
+            mStream.Write(MakeRecord(retry));
+            mStream.Sync();
+        }
+    }
+
+    void Journal::RunCompaction() {
+        std::unique_lock lk{mLock};
+        while (!mStop) {
+            mWake.wait_for(lk, CompactInterval, [this]() { return mStop || mPending.size() >= CompactThreshold; });
+            if (mStop || mPending.empty()) continue;
+            lk.unlock();
+            try { Compact(); }
+            catch (...) {
+                // ignore, retry on next round
+            }
+            lk.lock();
+        }
+    }
+
+    std::string Journal::Relative(const std::filesystem::path& target) const {
+        const auto abs = std::filesystem::absolute(target).lexically_normal();
+        const auto rel = abs.lexically_relative(mBase);
+        if (rel.empty() || *rel.begin()=="..") return abs.generic_string();
+        return rel.generic_string();
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <filesystem>
+#include <unordered_set>
+#include <condition_variable>
+#include "Utils/File.h"
+
+namespace Configure::Manager {
+    // Write-ahead journal for the metadata files of a warehouse, shared by all processes working on it.
+    // Each committed batch is one journal record made durable by a single fsync. Records are appended under a shared
+    // lock. Compaction takes the lock exclusively, folds every record in the file into the target files, whoever
+    // committed it, and truncates the file in place. Records left over by a crash are folded on the next open.
+    // Writes to targets whose directory has been removed since are dropped, failed writes are kept for the next fold.
+    class Journal {
+    public:
+        class Batch {
+        public:
+            void Put(const std::filesystem::path& target, std::string content);
+            [[nodiscard]] bool Empty() const noexcept { return mEntries.empty(); }
+        private:
+            friend class Journal;
+            std::vector<std::pair<std::filesystem::path, std::string>> mEntries;
+        };
+
+        explicit Journal(const std::filesystem::path& file);
+        Journal(const Journal&) = delete;
+        Journal& operator=(const Journal&) = delete;
+        ~Journal();
+        void Commit(Batch&& batch);
+        void Compact();
+    private:
+        void Fold();
+        void RunCompaction();
+        [[nodiscard]] std::string Relative(const std::filesystem::path& target) const;
+        bool mStop{false};
+        std::filesystem::path mFile, mBase, mLockFile;
+        Utils::AppendFile mStream;
+        std::mutex mLock, mCompacting;
+        std::condition_variable mWake;
+        // targets committed by this process and not folded yet, only to know when to compact
+        std::unordered_set<std::string> mPending;
+        std::thread mCompactor;
+    };
+}
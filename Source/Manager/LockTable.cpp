@@ -0,0 +1,41 @@
+#include "LockTable.h"
+
+namespace Configure::Manager {
+    LockTable::LockTable(std::filesystem::path home): mHome(std::move(home)) {
+        std::filesystem::create_directories(mHome);
+    }
+
+    Utils::FileLock LockTable::Acquire(const Scope scope, const std::string& name, const Utils::FileLock::Mode mode) {
+        // only a lock that is not free right away counts as a wait
+        if (auto lock = TryAcquire(scope, name, mode); lock.Held()) return lock;
+        const auto start = std::chrono::steady_clock::now();
+        Utils::FileLock lock{mHome/(std::string(NameOf(scope))+'-'+name+".lock"), mode};
+        const auto waited = std::chrono::steady_clock::now()-start;
+        std::lock_guard lk{mLock};
+        auto& stats = mStats[static_cast<int>(scope)];
+        ++stats.Acquired;
+        ++stats.Contended;
+        stats.Waited += waited;
+        stats.Longest = std::max<std::chrono::nanoseconds>(stats.Longest, waited);
+        return lock;
+    }
+
+    Utils::FileLock LockTable::TryAcquire(const Scope scope, const std::string& name, const Utils::FileLock::Mode mode) {
+        Utils::FileLock lock{mHome/(std::string(NameOf(scope))+'-'+name+".lock"), mode, false};
+        if (lock.Held()) {
+            std::lock_guard lk{mLock};
+            ++mStats[static_cast<int>(scope)].Acquired;
+        }
+        return lock;
+    }
+
+    std::array<LockTable::Stats, LockTable::ScopeCount> LockTable::Report() {
+        std::lock_guard lk{mLock};
+        return mStats;
+    }
+
+    std::string_view LockTable::NameOf(const Scope scope) noexcept {
+        static constexpr std::string_view names[] = {"cabinet", "module", "workspace", "staging", "snapshot", "build"};
+        return names[static_cast<int>(scope)];
+    }
+}
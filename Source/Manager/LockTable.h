@@ -0,0 +1,38 @@
+#pragma once
+
+#include <array>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <cstdint>
+#include <string_view>
+#include <filesystem>
+#include "Utils/File.h"
+
+namespace Configure::Manager {
+    // Advisory locks on the parts of a warehouse, shared by all processes working on it.
+    // Each cabinet, module repository and workspace has its own lock, so processes touching disjoint parts do not
+    // wait for each other. Lock files are never removed, removing one would let two holders lock different files.
+    class LockTable {
+    public:
+        enum class Scope { Cabinet, Module, Workspace, Staging, Snapshot, Build };
+        static constexpr std::size_t ScopeCount = 6;
+
+        struct Stats {
+            std::uint64_t Acquired{0}, Contended{0};
+            std::chrono::nanoseconds Waited{0}, Longest{0};
+        };
+
+        explicit LockTable(std::filesystem::path home);
+        [[nodiscard]] Utils::FileLock Acquire(Scope scope, const std::string& name, Utils::FileLock::Mode mode);
+        // Does not wait, the lock is not Held() if someone else has it
+        [[nodiscard]] Utils::FileLock TryAcquire(Scope scope, const std::string& name, Utils::FileLock::Mode mode);
+        // wait metrics by scope, in the order of Scope
+        [[nodiscard]] std::array<Stats, ScopeCount> Report();
+        [[nodiscard]] static std::string_view NameOf(Scope scope) noexcept;
+    private:
+        std::mutex mLock;
+        std::filesystem::path mHome;
+        std::array<Stats, ScopeCount> mStats{};
+    };
+}
@@ -1,29 +1,66 @@
-#include <date/date.h>
-#include <sstream>
 #include <unordered_set>
 #include "InterOp.h"
 #include "Json/Json.h"
+#include "Metadata.h"
 #include "Git2/Repository.h"
+#include "Utils/File.h"
+#include "Utils/Time.h"
+#include "Utils/SingleFlight.h"
 
 using namespace Configure::Manager::InterOp;
 
 namespace {
-    auto GetDate(const std::string& date) {
-        std::istringstream in{date};
-        date::sys_seconds tp;
-        in >> date::parse("%a,-%d-%b-%Y-%T-%z", tp);
-        return tp;
+    std::string FromDate(const Configure::Manager::SysSec& date) {
+        Utils::LegacyTimeText text{};
+        return std::string(Utils::FormatLegacyTime(date.time_since_epoch().count(), text));
     }
 
-    auto FromDate(const date::sys_seconds& date) {
-        std::ostringstream out{};
-        out << date::format("%a,-%d-%b-%Y-%T-%z", date);
-        return out.str();
+    Configure::Manager::SysSec ToDate(const Utils::UnixTime& time) noexcept {
+        return Configure::Manager::SysSec{std::chrono::seconds{time.Seconds}};
     }
 
-    void MakeSureRepoExists(const std::filesystem::path& home, const std::string& uri) {
-        if (std::filesystem::exists(home/RepoPath)) return;
-        Git2::Repository::Clone(home/RepoPath, uri);
+    // Pulls the branch the repository tracks. Every pull goes through here
+    void PullRepository(Git2::Repository& repo) {
+        repo.PullAuto({"DWVoid", "yshliu0321@icloud.com"}); // TODO: Add a config option for this
+    }
+
+    // Brings the repository at stage up to date with the remote, then moves it to target. Every completed round stays
+    // on disk for a later attempt to continue from: creating the repository, adding the remote and its default branch,
+    // and each fetch, whose objects are kept even when the checkout after it never happens.
+    // A stage that is not a repository at all is started over
+    void FetchResumable(const std::filesystem::path& stage, const std::filesystem::path& target, const std::string& uri) {
+        auto repo = [&]() {
+            if (std::filesystem::exists(stage)) {
+                try {
+                    return Git2::Repository::Open(stage);
+                }
+                catch (...) {
+                    Utils::RemoveTree(stage);
+                }
+            }
+            std::filesystem::create_directories(stage);
+            return Git2::Repository::Create(stage);
+        }();
+        repo.Track(uri);
+        PullRepository(repo);
+        if (stage!=target) std::filesystem::rename(stage, target);
+    }
+
+    // true if the repository had to be fetched here, it is then already up to date
+    bool MakeSureRepoExists(const std::filesystem::path& home, const std::string& uri) {
+        if (std::filesystem::exists(home/RepoPath)) return false;
+        // fetch next to the final place and move it in once complete, so that an interrupted fetch is never taken for
+        // a working one and the next update can continue it
+        FetchResumable(home/RepoPartialPath, home/RepoPath, uri);
+        return true;
+    }
+
+    // Pulls into the repository, or joins the pull already running on it in another thread.
+    // The key is the repository on disk, whichever cabinet or module object asks for it
+    template <class Fn>
+    void Pull(const std::filesystem::path& repo, Fn fn) {
+        static Utils::SingleFlight flights{PullCoalesceWindow};
+        flights.Do(std::filesystem::absolute(repo).lexically_normal().string(), std::move(fn));
     }
 }
 
@@ -34,30 +71,40 @@ namespace Configure::Manager {
         if (!std::filesystem::exists(home/InfoPath)) Corruption(MsgModuleDirCorrupted);
         mIsFull = std::filesystem::exists(home/RepoPath);
         // Load Basic Info
-        const auto waterfall = [&]() {
-            const auto list = Json::Load(home/InfoPath);
-            // Fields must exist
-            if (const auto x = list.find(KeyModuleInfoId.data()); x!=list.end()) mId = *x; else return false;
-            if (const auto x = list.find(KeyModuleInfoUri.data()); x!=list.end()) mUri = *x; else return false;
-            if (const auto x = list.find(KeyModuleInfoDisplay.data()); x!=list.end()) mDisplay = *x; else return false;
-            // Optional Fields
-            if (const auto x = list.find(KeyModuleInfoLPull.data()); x!=list.end()) mLastUpdate = GetDate(*x);
-            if (const auto x = list.find(KeyModuleInfoLCommit.data()); x!=list.end()) mLastCommit = GetDate(*x);
-            return true;
-        };
-        if (!waterfall()) Corruption(MsgModuleInfoCorrupted);
+        auto info = LoadModuleInfo(home/InfoPath);
+        // Fields must exist
+        if (!info.Id || !info.Uri || !info.Display) Corruption(MsgModuleInfoCorrupted);
+        mId = std::move(*info.Id);
+        mUri = std::move(*info.Uri);
+        mDisplay = std::move(*info.Display);
+        // Optional Fields
+        if (info.LastPull) mLastUpdate = ToDate(*info.LastPull);
+        if (info.LastCommit) mLastCommit = ToDate(*info.LastCommit);
     }
 
     std::string Module::LastUpdateUtc() const { return FromDate(LastUpdate()); }
 
-    std::string Module::LastCommitUtc() const { return FromDate(LastUpdate()); }
+    std::string Module::LastCommitUtc() const { return FromDate(LastCommit()); }
 
     void Module::Update() {
-        MakeSureRepoExists(mHome, mUri);
+        Pull(mHome/RepoPath, [this]() {
+            if (MakeSureRepoExists(mHome, mUri)) return;
+            auto repo = Git2::Repository::Open(mHome/RepoPath);
+            PullRepository(repo);
+        });
         mIsFull=true;
         auto repo = Git2::Repository::Open(mHome/RepoPath);
-        repo.PullAuto({"DWVoid", "yshliu0321@icloud.com"}); // TODO: Add a config option for this
         mLastUpdate = std::chrono::time_point_cast<std::chrono::seconds>(std::chrono::system_clock::now());
+        mLastCommit = SysSec{std::chrono::seconds{repo.HeadCommitTime()}};
+    }
+
+    void Module::Persist(Journal::Batch& batch) const {
+        const auto stamp = [](SysSec time) -> std::optional<Utils::UnixTime> {
+            if (!time.time_since_epoch().count()) return std::nullopt;
+            return Utils::UnixTime{time.time_since_epoch().count()};
+        };
+        const ModuleInfo info{mId, mUri, mDisplay, stamp(mLastUpdate), stamp(mLastCommit)};
+        batch.Put(mHome/InfoPath, Json::Dump(Json::Schema::Encode(info), Json::Format::Compact));
     }
 
     void Module::Destruct() {
@@ -66,31 +113,39 @@ namespace Configure::Manager {
 
     std::filesystem::path Module::GetContentPath() const { return mHome/RepoPath; }
 
-    void DoValidation(const nlohmann::json& list) {
-        auto validate = [list = std::unordered_set<std::string>()](const std::string& val) mutable {
-            if (list.find(val)!=list.end()) Corruption("Duplicated Module Name in Module List");
-        };
-        validate(list["ns"]);
-        for (auto&& x : list["modules"]) validate(std::string(x[KeyModuleInfoId.data()]));
+    std::string Module::Revision() const {
+        if (!mIsFull) return {};
+        return Git2::Repository::Open(mHome/RepoPath).HeadOid();
     }
 
-    Cabinet Cabinet::Fetch(const std::filesystem::path& home, const std::string& uri) {
-        try {
-            std::filesystem::create_directories(home);
-            MakeSureRepoExists(home, uri);
-            const auto infoFilePath = home/RepoPath/InfoPath;
-            if (!std::filesystem::exists(infoFilePath)) Corruption(MsgCabinetCorrupted);
-            const auto list = Json::Load(infoFilePath);
-            DoValidation(list);
-            std::filesystem::create_directories(home/ModulesPath);
-            for (auto&& x : list["modules"]) {
-                const auto thisDir = home/ModulesPath/std::string(x[KeyModuleInfoId.data()]);
-                std::filesystem::create_directories(thisDir);
-                Json::Save(thisDir/InfoPath, x);
-            }
+    void DoValidation(const CabinetInfo& info) {
+        if (!info.Namespace) Corruption(MsgCabinetCorrupted);
+        std::unordered_set<std::string> names{};
+        for (auto&& x : info.Modules) {
+            if (!x.Id) Corruption(MsgCabinetCorrupted);
+            if (!names.insert(*x.Id).second) Corruption("Duplicated Module Name in Module List");
         }
-        catch (...) {
-            std::filesystem::remove_all(home);
+    }
+
+    Cabinet Cabinet::Fetch(const std::filesystem::path& home, const std::string& uri) {
+        // nothing is dropped on failure, a later fetch into the same home continues from what is there
+        std::filesystem::create_directories(home);
+        FetchResumable(home/RepoPath, home/RepoPath, uri);
+        const auto infoFilePath = home/RepoPath/InfoPath;
+        if (!std::filesystem::exists(infoFilePath)) Corruption(MsgCabinetCorrupted);
+        // goes through the document cache, Open below reuses the parse
+        const auto info = LoadCabinetInfo(infoFilePath);
+        DoValidation(info);
+        // module entries written by an earlier attempt may be out of date with the list
+        std::filesystem::remove_all(home/ModulesPath);
+        std::filesystem::create_directories(home/ModulesPath);
+        // entries are written as the cabinet has them, keys this version does not know about included
+        const auto document = Json::Load(infoFilePath);
+        for (auto&& x : document.at(std::string(KeyCabinetModules))) {
+            if (!x.is_object()) continue;
+            const auto thisDir = home/ModulesPath/x.at(std::string(KeyModuleInfoId)).get<std::string>();
+            std::filesystem::create_directories(thisDir);
+            Json::Save(thisDir/InfoPath, x, Json::Format::Compact);
         }
         return Open(home);
     }
@@ -98,21 +153,24 @@ namespace Configure::Manager {
     Cabinet Cabinet::Open(const std::filesystem::path& home) {
         const auto infoFilePath = home/RepoPath/InfoPath;
         if (!std::filesystem::exists(infoFilePath)) Corruption(MsgCabinetCorrupted);
-        const auto list = Json::Load(infoFilePath);
-        DoValidation(list);
+        auto info = LoadCabinetInfo(infoFilePath);
+        if (!info.Namespace) Corruption(MsgCabinetCorrupted);
         Cabinet result{};
-        result.mNs = list[KeyCabinetNamespace.data()];
+        result.mNs = std::move(*info.Namespace);
         result.mHome = home;
-        for (auto&& x : list["modules"]) {
-            const auto thisDir = home/ModulesPath/std::string(x[KeyModuleInfoId.data()]);
-            result.mModules.insert_or_assign(std::string(x[KeyModuleInfoId.data()]), Module{thisDir});
+        for (auto&& x : info.Modules) {
+            if (!x.Id) Corruption(MsgCabinetCorrupted);
+            const auto thisDir = home/ModulesPath/ *x.Id;
+            result.mModules.insert_or_assign(std::move(*x.Id), Module{thisDir});
         }
         return result;
     }
 
     void Cabinet::UpdateUnsafe() {
-        auto repo = Git2::Repository::Open(mHome/RepoPath);
-        repo.PullAuto({"DWVoid", "yshliu0321@icloud.com"}); // TODO: Add a config option for this
+        Pull(mHome/RepoPath, [this]() {
+            auto repo = Git2::Repository::Open(mHome/RepoPath);
+            PullRepository(repo);
+        });
     }
 
     void Cabinet::Add(const std::string& uri, const std::string& name, const std::string& display) {
@@ -121,15 +179,11 @@ namespace Configure::Manager {
         if (mModules.find(name)!=mModules.end()) throw std::runtime_error("Name is already used");
         const auto thisDir = mHome/ModulesPath/name;
         std::filesystem::create_directories(thisDir);
-        nlohmann::json json{};
-        json[KeyModuleInfoId.data()] = uri;
-        json[KeyModuleInfoUri.data()] = name;
-        json[KeyModuleInfoDisplay.data()] = display;
-        Json::Save(thisDir/InfoPath, json);
+        Json::Save(thisDir/InfoPath, Json::Schema::Encode(ModuleInfo{name, uri, display, std::nullopt, std::nullopt}), Json::Format::Compact);
         mModules.insert_or_assign(name, Module{thisDir});
     }
 
-    void Cabinet::Remove(const std::string& name) {
+    void Cabinet::RemoveUnsafe(const std::string& name) {
         const auto iter = mModules.find(name);
         if (iter==mModules.end()) return;
         iter->second.Destruct();
@@ -1,11 +1,22 @@
 #pragma once
 
 #include <chrono>
+#include <iosfwd>
+#include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 #include <filesystem>
 #include <unordered_map>
+#include <unordered_set>
 #include <exception>
+#include "Journal.h"
+#include "Snapshot.h"
+#include "BuildCache.h"
+#include "Trash.h"
+#include "LockTable.h"
+#include "ManifestStore.h"
+#include "Utils/ErrorList.h"
 
 namespace Configure::Manager {
 	using SysSec = std::chrono::time_point<std::chrono::system_clock, std::chrono::seconds>;
@@ -21,7 +32,9 @@ namespace Configure::Manager {
 		[[nodiscard]] std::string LastCommitUtc() const;
 		[[nodiscard]] SysSec LastUpdate() const noexcept { return mLastUpdate; }
 		[[nodiscard]] SysSec LastCommit() const noexcept { return mLastCommit; }
+		[[nodiscard]] std::string Revision() const;
 		void Update();
+		void Persist(Journal::Batch& batch) const;
 		void Destruct();
 		[[nodiscard]] std::filesystem::path GetContentPath() const;
 	private:
@@ -36,28 +49,105 @@ namespace Configure::Manager {
 	    static Cabinet Fetch(const std::filesystem::path& home, const std::string& uri);
 	    static Cabinet Open(const std::filesystem::path& home);
 	    [[nodiscard]] auto& Namespace() const noexcept { return mNs; }
+	    [[nodiscard]] auto& Home() const noexcept { return mHome; }
 	    void Add(const std::string& uri, const std::string& name, const std::string& display);
-	    void Remove(const std::string& name);
 	    [[nodiscard]] Module* Get(const std::string& name);
 	    template <class Fn> void Enumerate(Fn fn) { for (auto&& [_, x]: mModules) fn(x); }
 	    // Internal API
         void UpdateUnsafe();
+        // workspaces may still hold the module, remove it through the warehouse
+        void RemoveUnsafe(const std::string& name);
 	private:
 	    std::string mNs;
 	    std::filesystem::path mHome;
 	    std::unordered_map<std::string, Module> mModules;
     };
 
+	class Warehouse;
+
+	namespace InterOp { class Resolver; }
+
+	enum class Materialize {
+	    Symlink, // each module is a directory symlink to the shared working tree
+	    HardLink, // each module is a real directory tree of hard links into the shared working tree
+	    Reflink, // each module is a real directory tree of copy-on-write clones, or copies where unsupported
+	    Pinned, // each module is a private tree checked out from the local object database at its pinned commit
+	    Snapshot // each module is a directory symlink to the shared read-only snapshot of its current tree
+	};
+
+	struct ReconcileStep {
+	    enum Kind { Link, Unlink, Relink } Action;
+	    std::string Module;
+	    std::filesystem::path From, To;
+	};
+
+	std::ostream& operator<<(std::ostream& out, const ReconcileStep& step);
+
 	class Workspace {
 	public:
-	    explicit Workspace(const std::filesystem::path& home);
+	    using RootMap = std::unordered_map<std::string, bool>;
+	    using PinMap = std::unordered_map<std::string, std::string>;
+	    // loads the workspace recorded under the warehouse, or starts an empty one if there is none
+	    Workspace(Warehouse& warehouse, std::string name);
+	    [[nodiscard]] auto& Name() const noexcept { return mName; }
+	    [[nodiscard]] auto Mode() const noexcept { return mMode; }
+	    [[nodiscard]] Utils::CloneStats Stats() const noexcept;
+	    // commit of each checked out module as recorded in the lockfile
+	    [[nodiscard]] auto& Locked() const noexcept { return mLock; }
+	    // where the module is checked out, if it is
+	    [[nodiscard]] std::optional<std::filesystem::path> CheckoutOf(const std::string& module) const;
+	    void Pin(PinMap commits) { mPins = std::move(commits); }
+	    [[nodiscard]] std::vector<ReconcileStep> Plan(const RootMap& roots, Materialize mode) const;
+	    void Apply(const RootMap& roots, Materialize mode, const std::vector<ReconcileStep>& plan);
+	    // all modules the module transitively depends on, sorted by name
+	    [[nodiscard]] std::vector<std::string> Closure(const std::string& module) const;
 	    void Reload();
-	    void Update();
+	    // modules that failed to update are recorded into errors, the others are updated all the same
+	    void Update(Journal::Batch& batch, Utils::ErrorList& errors);
 	    void Destruct();
+	    // Internal API
+	    // the same against a resolver shared by all workspaces of one operation, which indexes every cabinet once
+	    Workspace(Warehouse& warehouse, std::string name, const InterOp::Resolver& resolver);
+	    [[nodiscard]] std::vector<ReconcileStep> Plan(const RootMap& roots, Materialize mode, const InterOp::Resolver& resolver) const;
+	    void Apply(const RootMap& roots, Materialize mode, const std::vector<ReconcileStep>& plan, const InterOp::Resolver& resolver);
+	    [[nodiscard]] std::vector<std::string> Closure(const std::string& module, const InterOp::Resolver& resolver) const;
+	    void Reload(const InterOp::Resolver& resolver);
+	    void Update(Journal::Batch& batch, Utils::ErrorList& errors, const InterOp::Resolver& resolver);
+	    template <class Fn> void Enumerate(Fn fn) { for (auto&& [name, mod, root]: mList) fn(name, *mod, root); }
+	    template <class Fn> void EnumerateRoots(Fn fn) const { for (auto&& [name, inTree]: mRoots) fn(name, inTree); }
+	    template <class Fn> void EnumerateCheckout(Fn fn) const { for (auto&& [name, path]: mCheckout) fn(name, path); }
 	private:
+	    Warehouse* mHouse;
+	    std::string mName;
+	    Materialize mMode;
+	    RootMap mRoots;
+	    std::unordered_map<std::string, std::filesystem::path> mCheckout;
+	    std::unordered_map<std::string, Utils::CloneStats> mStats;
+	    PinMap mPins, mLock;
 	    std::vector<std::tuple<std::string, Module*, bool>> mList;
 	};
 
+	// Immutable copy of the warehouse state as of one version.
+	// A view is never changed after it is published, any thread may read it while the warehouse moves on.
+	struct WarehouseView {
+	    struct ModuleView {
+	        std::string Id, Uri, Display;
+	        bool IsFull;
+	        SysSec LastUpdate, LastCommit;
+	    };
+	    struct WorkspaceView {
+	        Materialize Mode;
+	        Workspace::RootMap Roots;
+	        std::unordered_map<std::string, std::filesystem::path> Checkout;
+	        Workspace::PinMap Locked;
+	        Utils::CloneStats Stats;
+	    };
+	    std::uint64_t Version;
+	    // namespace to module id to module
+	    std::unordered_map<std::string, std::unordered_map<std::string, ModuleView>> Cabinets;
+	    std::unordered_map<std::string, WorkspaceView> Workspaces;
+	};
+
 	class Warehouse {
     public:
         struct CheckoutArgs {
@@ -67,24 +157,105 @@ namespace Configure::Manager {
             };
             std::string Name;
             std::vector<ModuleArgs> Modules;
+            Materialize Mode = Materialize::Symlink;
+        };
+
+        struct GcReport {
+            std::vector<std::filesystem::path> Garbage;
+            std::uintmax_t Bytes{0};
+        };
+
+        struct BuildLease {
+            std::string Key; // empty if the inputs cannot be identified and the output is private to the workspace
+            std::filesystem::path Path;
+            bool Hit;
         };
 
         explicit Warehouse(const std::filesystem::path& home);
+        [[nodiscard]] auto& Home() const noexcept { return mHome; }
+        // Latest published view of the warehouse. Safe to call from any thread, also while another one is updating.
+        // Everything else on the warehouse is for one thread at a time
+        [[nodiscard]] std::shared_ptr<const WarehouseView> View() const { return std::atomic_load(&mView); }
+        [[nodiscard]] auto& Snapshots() noexcept { return mSnapshots; }
+        std::size_t PruneSnapshots();
+        // Sweeps everything under the warehouse directory that no live cabinet or workspace can reach.
+        // The garbage is moved out of the way at once and deleted in the background
+        GcReport CollectGarbage(bool dryRun = false);
+        // Output directory for building the module in the workspace. On a hit it holds the shared output already,
+        // otherwise the caller builds into it and hands it back with PublishBuildTree
+        [[nodiscard]] BuildLease AcquireBuildTree(const std::string& workspace, const std::string& module, const std::string& toolchain);
+        void PublishBuildTree(const std::string& workspace, const std::string& module, const BuildLease& lease);
+        [[nodiscard]] BuildCache::Stats BuildCacheStats() { return mBuilds.Report(); }
+        // Locks shared with the other processes working on this warehouse. The metrics are safe to read from any thread
+        [[nodiscard]] auto& Locks() noexcept { return mLocks; }
+        // Internal API
+        [[nodiscard]] auto& Manifests() const noexcept { return mManifests; }
         void ImportCabinet(const std::string& uri);
+        // Fetches all cabinets at once, each into a staging directory of its own, and commits them one after another.
+        // A failed import does not stop the others, its error is at the same position as its uri
+        std::vector<std::exception_ptr> ImportCabinets(const std::vector<std::string>& uris);
+        // Fetched data of imports that failed is kept to continue from, until it has not been touched for this long
+        void SetStagingExpiry(std::chrono::seconds age) noexcept { mStagingExpiry = age; }
+        // Workspaces using the cabinet, or the module, are resolved again without it
         void RemoveCabinet(const std::string& name);
+        void RemoveModule(const std::string& name);
         [[nodiscard]] Cabinet* GetCabinet(const std::string& name);
+        [[nodiscard]] Module* FindModule(const std::string& name);
         void UpdateCabinet(const std::string& name);
         void UpdateCabinets();
         template <class Fn> void EnumerateCabinets(Fn fn) { for (auto&& [_, x]: mCabinets) fn(x); }
         void CreateWorkspace(const CheckoutArgs& args);
+        // Creates many workspaces over one module index and one resolution pass, linking their trees in parallel.
+        // A failed workspace does not stop the others, its error is at the same position as its arguments
+        std::vector<std::exception_ptr> CreateWorkspaces(const std::vector<CheckoutArgs>& batch);
+        std::vector<ReconcileStep> ReconcileWorkspace(const CheckoutArgs& args, bool dryRun = false);
+        void CheckoutFrozen(const std::string& name, const std::filesystem::path& lockFile);
         void RemoveWorkspace(const std::string& name);
         [[nodiscard]] Workspace* GetWorkspace(const std::string& name);
+        void UpdateWorkspace(const std::string& name);
         template <class Fn> void EnumerateWorkspaces(Fn fn) { for (auto&& [_, x]: mWorkspaces) fn(x); }
 	private:
 	    void Load(const std::filesystem::path& path);
+        struct Staged {
+            std::filesystem::path Path;
+            Utils::FileLock Lock;
+        };
+
+        Staged StageCabinet(const std::string& uri);
+        void CommitCabinet(Staged stage);
+        std::vector<ReconcileStep> Reconcile(const CheckoutArgs& args, bool dryRun, const Workspace::PinMap* pins);
         void ReloadWorkspaces();
+        void ReloadWorkspaces(const std::unordered_set<std::string>& names);
+        void ReloadWorkspaces(const std::unordered_set<std::string>& names, Utils::ErrorList& errors);
+        void IndexWorkspace(Workspace& workspace);
+        void UnindexWorkspace(const std::string& name);
+        [[nodiscard]] std::string CabinetOf(const std::string& module) const;
+        struct SnapshotMark {
+            // the store lock, links to snapshots are only made while it is held shared
+            Utils::FileLock Lock;
+            // empty if a workspace could not be read, then no snapshot can be told to be unused
+            std::optional<std::unordered_set<std::string>> Live;
+        };
+
+        [[nodiscard]] SnapshotMark MarkSnapshots();
+        void LinkBuildTree(const std::string& workspace, const std::string& module, const std::filesystem::path& output);
+        // cache keys linked into any workspace, by every process
+        [[nodiscard]] std::unordered_set<std::string> LinkedBuildTrees() const;
+        static void UnlinkBuildTree(const std::filesystem::path& path);
+        void Publish() noexcept;
         std::filesystem::path mHome;
+        std::chrono::seconds mStagingExpiry;
+        LockTable mLocks;
+        Trash mTrash;
+        Journal mJournal;
+        SnapshotStore mSnapshots;
+        BuildCache mBuilds;
+        ManifestStore mManifests;
         std::unordered_map<std::string, Cabinet> mCabinets;
         std::unordered_map<std::string, Workspace> mWorkspaces;
+        // reverse index: module (ns.id) and cabinet (ns) to the workspaces referencing them
+        std::unordered_map<std::string, std::unordered_set<std::string>> mModuleUsers, mCabinetUsers;
+        std::unordered_map<std::string, std::vector<std::string>> mWorkspaceRefs;
+        std::shared_ptr<const WarehouseView> mView;
     };
 }
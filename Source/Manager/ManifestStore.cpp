@@ -0,0 +1,68 @@
+#include "ManifestStore.h"
+#include <cctype>
+#include <algorithm>
+#include "InterOp.h"
+#include "DocumentCache.h"
+#include "Json/Json.h"
+#include "Utils/File.h"
+#include "Git2/Repository.h"
+
+using namespace Configure::Manager::InterOp;
+
+namespace {
+    // the version is part of the name, entries of another layout are never read as this one
+    constexpr std::string_view BlobDir{"Blobs.v2"};
+    constexpr std::string_view CommitDir{"Commits"};
+
+    // ids end up as file names, nothing but a full hex id may get there
+    void ValidateOid(const std::string& oid) {
+        const auto hex = [](char c) { return std::isxdigit(static_cast<unsigned char>(c))!=0; };
+        if (oid.size()!=40 || !std::all_of(oid.begin(), oid.end(), hex)) throw std::runtime_error("Invalid object id: "+oid);
+    }
+
+    Configure::Manager::ModuleManifest Decode(const std::filesystem::path& file) {
+        const Utils::MappedFile map{file};
+        return Json::Schema::Decode<Configure::Manager::ModuleManifest>(map.View());
+    }
+}
+
+namespace Configure::Manager {
+    ManifestStore::ManifestStore(std::filesystem::path home)
+            :mHome(std::move(home)) {
+        std::filesystem::create_directories(mHome/BlobDir);
+        std::filesystem::create_directories(mHome/CommitDir);
+    }
+
+    bool ManifestStore::Stale(const std::string& name) { return name!=BlobDir && name!=CommitDir; }
+
+    std::optional<std::string> ManifestStore::BlobOf(const std::filesystem::path& repo, const std::string& commit) const {
+        const auto record = mHome/CommitDir/commit;
+        if (std::filesystem::exists(record)) {
+            const Utils::MappedFile map{record};
+            return std::string(map.View());
+        }
+        if (!std::filesystem::exists(repo)) return std::nullopt;
+        // an empty record stands for a commit without a manifest
+        auto blob = Git2::Repository::Open(repo).BlobAt(commit, std::string(ManifestPath));
+        Utils::WriteAtomic(record, blob);
+        return blob;
+    }
+
+    std::optional<ModuleManifest> ManifestStore::At(const std::filesystem::path& repo, const std::string& commit) const {
+        ValidateOid(commit);
+        const auto blob = BlobOf(repo, commit);
+        if (!blob || blob->empty()) return std::nullopt;
+        ValidateOid(*blob);
+        const auto entry = mHome/BlobDir/ *blob;
+        if (std::filesystem::exists(entry)) {
+            try { return *Documents().Get<ModuleManifest>(entry, Decode); }
+            catch (...) {
+                // not written by us or damaged, made again below from the blob
+            }
+        }
+        if (!std::filesystem::exists(repo)) return std::nullopt;
+        auto manifest = ParseModuleManifest(Git2::Repository::Open(repo).ReadBlob(*blob));
+        Json::Save(entry, Json::Schema::Encode(manifest), Json::Format::Cbor);
+        return manifest;
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+#include <optional>
+#include <filesystem>
+#include "Metadata.h"
+
+namespace Configure::Manager {
+    // Module manifests of any revision, read from the object databases and kept on disk by content.
+    // A parsed manifest is stored under the id of its blob, and each commit looked at records which blob it has, so
+    // a revision seen once resolves without its repository, a checkout or a parse. Entries never change once written
+    // and are written with a rename, processes sharing the warehouse may fill and read the store at the same time.
+    class ManifestStore {
+    public:
+        explicit ManifestStore(std::filesystem::path home);
+        // Manifest of the module repository at the commit, empty if the commit has none or is not known to the
+        // store and there is no repository to look it up in
+        [[nodiscard]] std::optional<ModuleManifest> At(const std::filesystem::path& repo, const std::string& commit) const;
+        // Whether the entry of the store directory is left over from an earlier layout
+        [[nodiscard]] static bool Stale(const std::string& name);
+    private:
+        [[nodiscard]] std::optional<std::string> BlobOf(const std::filesystem::path& repo, const std::string& commit) const;
+        std::filesystem::path mHome;
+    };
+}
@@ -0,0 +1,28 @@
+#include "Metadata.h"
+#include "InterOp.h"
+#include "DocumentCache.h"
+#include "Utils/File.h"
+
+namespace {
+    template <class T>
+    T Read(const std::filesystem::path& file) {
+        const Utils::MappedFile map{file};
+        return Json::Schema::Decode<T>(map.View());
+    }
+}
+
+namespace Configure::Manager {
+    ModuleInfo LoadModuleInfo(const std::filesystem::path& file) { return *Documents().Get<ModuleInfo>(file, Read<ModuleInfo>); }
+
+    CabinetInfo LoadCabinetInfo(const std::filesystem::path& file) { return *Documents().Get<CabinetInfo>(file, Read<CabinetInfo>); }
+
+    ModuleManifest LoadModuleManifest(const std::filesystem::path& file) {
+        return *Documents().Get<ModuleManifest>(file, Read<ModuleManifest>);
+    }
+
+    ModuleManifest ParseModuleManifest(std::string_view text) { return Json::Schema::Decode<ModuleManifest>(text); }
+
+    std::shared_ptr<const nlohmann::json> LoadDocument(const std::filesystem::path& file) {
+        return Documents().Get<nlohmann::json>(file, [](const std::filesystem::path& path) { return Json::Load(path); });
+    }
+}
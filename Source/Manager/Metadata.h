@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <optional>
+#include <string_view>
+#include <filesystem>
+#include "Json/Json.h"
+#include "Utils/Time.h"
+
+namespace Configure::Manager {
+    // Typed content of the metadata files of a warehouse.
+    // The loaders map the file and fill the structs straight from the parser events through the schemas in InterOp.h,
+    // no document is built in between.
+    // Fields absent from the file are left empty, malformed files throw like Json::Load does.
+    // All of them read through the document cache, a file is only parsed again after it has changed.
+
+    // info.json of a module, or one entry of the module list of a cabinet
+    struct ModuleInfo {
+        std::optional<std::string> Id, Uri, Display;
+        std::optional<Utils::UnixTime> LastPull, LastCommit;
+    };
+
+    // info.json in the repository of a cabinet
+    struct CabinetInfo {
+        std::optional<std::string> Namespace;
+        std::vector<ModuleInfo> Modules;
+    };
+
+    // module.json in the repository of a module
+    struct ModuleManifest {
+        std::vector<std::string> Depends;
+        // dependency name prefix to its replacement
+        std::vector<std::pair<std::string, std::string>> Import;
+    };
+
+    [[nodiscard]] ModuleInfo LoadModuleInfo(const std::filesystem::path& file);
+    [[nodiscard]] CabinetInfo LoadCabinetInfo(const std::filesystem::path& file);
+    [[nodiscard]] ModuleManifest LoadModuleManifest(const std::filesystem::path& file);
+    // module.json content that is not in a file, as read from an object database
+    [[nodiscard]] ModuleManifest ParseModuleManifest(std::string_view text);
+    // Any other JSON file, as a whole document
+    [[nodiscard]] std::shared_ptr<const nlohmann::json> LoadDocument(const std::filesystem::path& file);
+}
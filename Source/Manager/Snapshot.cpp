@@ -0,0 +1,78 @@
+#include "Snapshot.h"
+#include <vector>
+#include "Git2/Repository.h"
+
+namespace {
+    using Perms = std::filesystem::perms;
+
+    constexpr auto WriteBits = Perms::owner_write | Perms::group_write | Perms::others_write;
+
+    void MakeReadOnly(const std::filesystem::path& path) {
+        for (auto&& x : std::filesystem::recursive_directory_iterator(path)) {
+            if (!x.is_symlink()) std::filesystem::permissions(x.path(), WriteBits, std::filesystem::perm_options::remove);
+        }
+        std::filesystem::permissions(path, WriteBits, std::filesystem::perm_options::remove);
+    }
+}
+
+namespace Configure::Manager {
+    SnapshotStore::SnapshotStore(std::filesystem::path home, std::filesystem::path temp)
+            :mHome(std::filesystem::absolute(home)), mTemp(std::move(temp)) {
+        std::filesystem::create_directories(mHome);
+        std::filesystem::create_directories(mTemp);
+    }
+
+    std::filesystem::path SnapshotStore::Acquire(const std::filesystem::path& repo, const std::string& commit, Utils::CloneStats& stats) {
+        auto source = Git2::Repository::Open(repo);
+        const auto tree = source.TreeOf(commit);
+        const auto target = mHome/tree;
+        if (std::filesystem::exists(target)) {
+            stats.Shared += Utils::TreeSize(target);
+            return target;
+        }
+        // stage the tree next to the store and publish it with one rename, racing writers produce the same content
+        const auto stage = mTemp/Utils::UniqueName("Snapshot-"+tree);
+        try {
+            source.CheckoutTo(commit, stage);
+            MakeReadOnly(stage);
+            // moving a directory to another parent rewrites its '..' entry, it has to stay writable until then
+            std::filesystem::permissions(stage, Perms::owner_write, std::filesystem::perm_options::add);
+            std::error_code ec{};
+            std::filesystem::rename(stage, target, ec);
+            if (ec) {
+                if (!std::filesystem::exists(target)) throw std::filesystem::filesystem_error("rename", stage, target, ec);
+                Utils::RemoveTree(stage);
+                stats.Shared += Utils::TreeSize(target);
+                return target;
+            }
+        }
+        catch (...) {
+            if (std::filesystem::exists(stage)) Utils::RemoveTree(stage);
+            throw;
+        }
+        std::filesystem::permissions(target, WriteBits, std::filesystem::perm_options::remove);
+        stats.Copied += Utils::TreeSize(target);
+        return target;
+    }
+
+    bool SnapshotStore::Owns(const std::filesystem::path& path) const {
+        return path.lexically_normal().parent_path()==mHome.lexically_normal();
+    }
+
+    std::size_t SnapshotStore::Prune(const std::unordered_set<std::string>& live) {
+        std::vector<std::string> drop{};
+        Enumerate([&](const std::string& tree) { if (live.find(tree)==live.end()) drop.push_back(tree); });
+        for (auto&& x : drop) Drop(x);
+        return drop.size();
+    }
+
+    void SnapshotStore::Drop(const std::string& tree) {
+        const auto target = mHome/tree;
+        if (!std::filesystem::exists(target)) return;
+        // take it out of the store first so that no new workspace picks up a half removed tree
+        const auto trash = mTemp/Utils::UniqueName("Dropped-"+tree);
+        std::filesystem::permissions(target, Perms::owner_write, std::filesystem::perm_options::add);
+        std::filesystem::rename(target, trash);
+        Utils::RemoveTree(trash);
+    }
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <filesystem>
+#include <unordered_set>
+#include "Utils/File.h"
+
+namespace Configure::Manager {
+    // Immutable module trees keyed by git tree id.
+    // A tree is materialized once, made read-only and then shared by every workspace that uses it.
+    class SnapshotStore {
+    public:
+        explicit SnapshotStore(std::filesystem::path home, std::filesystem::path temp);
+        // Returns the snapshot of the tree of commit in the repository, materializing it on first use.
+        // Stats report the tree as copied when it was materialized by this call and as shared otherwise
+        std::filesystem::path Acquire(const std::filesystem::path& repo, const std::string& commit, Utils::CloneStats& stats);
+        [[nodiscard]] bool Owns(const std::filesystem::path& path) const;
+        template <class Fn> void Enumerate(Fn fn) const {
+            for (auto&& x: std::filesystem::directory_iterator(mHome)) if (x.is_directory()) fn(x.path().filename().string());
+        }
+        // Drops every snapshot not in live, returns the number of snapshots dropped
+        std::size_t Prune(const std::unordered_set<std::string>& live);
+        void Drop(const std::string& tree);
+    private:
+        std::filesystem::path mHome, mTemp;
+    };
+}
@@ -0,0 +1,51 @@
+#include "Trash.h"
+#include "Utils/File.h"
+
+namespace Configure::Manager {
+    Trash::Trash(std::filesystem::path temp)
+            :mTemp(std::move(temp)) {
+        std::filesystem::create_directories(mTemp);
+        mWorker = std::thread([this]() { Run(); });
+    }
+
+    Trash::~Trash() {
+        {
+            std::lock_guard lk{mLock};
+            mStop = true;
+        }
+        mWake.notify_all();
+        mWorker.join();
+    }
+
+    void Trash::Put(const std::filesystem::path& path) {
+        if (!std::filesystem::exists(std::filesystem::symlink_status(path))) return;
+        auto target = mTemp/Utils::UniqueName("Trash");
+        // a read-only directory cannot get its '..' entry rewritten, give it the write bit back first
+        std::error_code ec{};
+        std::filesystem::permissions(path, std::filesystem::perms::owner_write, std::filesystem::perm_options::add, ec);
+        std::filesystem::rename(path, target);
+        // the age of temp entries decides whether the collector may take them, this one is spoken for
+        std::filesystem::last_write_time(target, std::filesystem::file_time_type::clock::now(), ec);
+        {
+            std::lock_guard lk{mLock};
+            mQueue.push_back(std::move(target));
+        }
+        mWake.notify_one();
+    }
+
+    void Trash::Run() {
+        std::unique_lock lk{mLock};
+        for (;;) {
+            mWake.wait(lk, [this]() { return mStop || !mQueue.empty(); });
+            if (mQueue.empty()) return;
+            const auto next = std::move(mQueue.front());
+            mQueue.pop_front();
+            lk.unlock();
+            try { Utils::RemoveTree(next); }
+            catch (...) {
+                // ignore, what is left over in the temp directory is picked up by the next collection
+            }
+            lk.lock();
+        }
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <filesystem>
+#include <condition_variable>
+
+namespace Configure::Manager {
+    // Deferred deletion of directory trees.
+    // A tree is renamed out of the way on Put, so it is gone from its place at once, and removed from disk by a
+    // background thread. Pending deletions are finished before the destructor returns.
+    class Trash {
+    public:
+        explicit Trash(std::filesystem::path temp);
+        Trash(const Trash&) = delete;
+        Trash& operator=(const Trash&) = delete;
+        ~Trash();
+        void Put(const std::filesystem::path& path);
+    private:
+        void Run();
+        bool mStop{false};
+        std::filesystem::path mTemp;
+        std::mutex mLock;
+        std::condition_variable mWake;
+        std::deque<std::filesystem::path> mQueue;
+        std::thread mWorker;
+    };
+}
@@ -1,19 +1,44 @@
-#include "Utils/Exception.h"
 #include "Json/Json.h"
+#include "Utils/File.h"
+#include "Git2/Repository.h"
+#include <atomic>
+#include <thread>
 #include <sstream>
+#include <optional>
 #include <algorithm>
 #include "InterOp.h"
+#include "Metadata.h"
 
 using namespace Configure::Manager::InterOp;
 
+namespace {
+    // runs the function when the scope is left, however that happens
+    template <class Fn>
+    struct Finally {
+        Fn Run;
+        ~Finally() { Run(); }
+    };
+
+    template <class Fn> Finally(Fn) -> Finally<Fn>;
+
+    std::string ReadManifest(const Configure::Manager::Module& mod) {
+        std::ifstream stream{mod.GetContentPath()/ManifestPath, std::ios::binary};
+        return {std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>()};
+    }
+}
+
 namespace Configure::Manager {
     Warehouse::Warehouse(const std::filesystem::path& home)
-            :mHome(home) {
+            :mHome(home), mStagingExpiry(PartialImportExpiry), mLocks(home/WarehouseDir/WarehouseLockDir), mTrash(home/WarehouseDir/WarehouseTempDir), mJournal(home/WarehouseDir/WarehouseJournalFile),
+             mSnapshots(home/WarehouseDir/WarehouseSnapshotDir, home/WarehouseDir/WarehouseTempDir),
+             mBuilds(home/WarehouseDir/BuildPath, home/WarehouseDir/WarehouseTempDir, BuildCacheCapacity, mLocks, [this]() { return LinkedBuildTrees(); }),
+             mManifests(home/WarehouseDir/WarehouseManifestDir) {
         const auto base = home/WarehouseDir;
         std::filesystem::create_directories(base);
         std::filesystem::create_directories(base/WarehouseTempDir);
         std::filesystem::create_directories(base/WarehouseStockDir);
         std::filesystem::create_directories(base/WarehouseWorkspaceDir);
+        std::filesystem::create_directories(base/WarehousePartialDir);
         for (auto&& x: std::filesystem::directory_iterator(base/WarehouseStockDir)) {
             if (!x.is_directory()) continue;
             try {
@@ -23,37 +48,115 @@ namespace Configure::Manager {
                 //ignore
             }
         }
+        const Resolver resolver{*this};
+        for (auto&& x: std::filesystem::directory_iterator(base/WarehouseWorkspaceDir)) {
+            if (!x.is_directory() || !std::filesystem::exists(WorkspaceState(x.path()))) continue;
+            try {
+                auto name = x.path().filename().string();
+                IndexWorkspace(mWorkspaces.insert_or_assign(name, Workspace(*this, name, resolver)).first->second);
+            }
+            catch (...) {
+                //ignore
+            }
+        }
+        Publish();
     }
 
     void Warehouse::ImportCabinet(const std::string& uri) {
-        std::string ns{};
-        const auto base = mHome/WarehouseDir;
-        const auto temp = base/WarehouseTempDir;
-        const auto stock = base/WarehouseStockDir;
-        const auto tmpTarget = temp/FetchProgressionTempDir;
-        // fetch the expand the target cabinet into a temp directory as we ho not know the name yet.
-        // if this step succeeds, we are sure that the target cabinet is in good state
-        try {
-            const auto cab = Cabinet::Fetch(tmpTarget, uri);
-            // scan the namespace name against the list. if there is conflict, throw a runtime error with message
-            if (mCabinets.find(cab.Namespace())!=mCabinets.end()) Corruption(MsgCabinetConflict);
-            // move the cab
-            ns = cab.Namespace();
-            std::filesystem::rename(tmpTarget, stock/ns);
+        const Finally publish{[this]() { Publish(); }};
+        CommitCabinet(StageCabinet(uri));
+    }
+
+    std::vector<std::exception_ptr> Warehouse::ImportCabinets(const std::vector<std::string>& uris) {
+        const Finally publish{[this]() { Publish(); }};
+        std::vector<std::exception_ptr> errors(uris.size());
+        std::vector<Staged> stages(uris.size());
+        // one uri shares one staging area, asking for it twice would only have the second attempt wait for the first
+        std::unordered_set<std::string> seen{};
+        for (std::size_t i = 0; i<uris.size(); ++i) {
+            if (seen.insert(uris[i]).second) continue;
+            try { throw std::runtime_error("Cabinet "+uris[i]+" given more than once"); }
+            catch (...) { errors[i] = std::current_exception(); }
         }
-        catch (...) {
-            // in-case of exception, drop the temp cab dir
-            std::filesystem::remove_all(tmpTarget);
-            throw;
+        // every import has a staging area of its own, the downloads run side by side up to a bound
+        std::atomic<std::size_t> next{0};
+        const auto worker = [&]() {
+            for (auto i = next++; i<uris.size(); i = next++) {
+                if (errors[i]) continue;
+                try { stages[i] = StageCabinet(uris[i]); }
+                catch (...) { errors[i] = std::current_exception(); }
+            }
+        };
+        std::vector<std::thread> workers{};
+        const auto count = std::min(ImportConcurrency, uris.size());
+        for (std::size_t i = 1; i<count; ++i) workers.emplace_back(worker);
+        worker();
+        for (auto&& x : workers) x.join();
+        // commit in the given order, of two imports of one namespace the earlier one wins
+        for (std::size_t i = 0; i<uris.size(); ++i) {
+            if (errors[i]) continue;
+            try { CommitCabinet(std::move(stages[i])); }
+            catch (...) { errors[i] = std::current_exception(); }
         }
-        // finally, load the cabinet into the list
+        return errors;
+    }
+
+    Warehouse::Staged Warehouse::StageCabinet(const std::string& uri) {
+        // fetch the expand the target cabinet into a staging area as we ho not know the name yet.
+        // the area belongs to the uri, so a retried import continues from where the last attempt stopped.
+        // if this step succeeds, we are sure that the target cabinet is in good state
+        const auto key = Git2::Hash(uri);
+        Staged result{mHome/WarehouseDir/WarehousePartialDir/key, mLocks.Acquire(LockTable::Scope::Staging, key, Utils::FileLock::Exclusive)};
+        std::filesystem::create_directories(result.Path);
+        // the age of a staging area is the time since its last attempt
+        std::filesystem::last_write_time(result.Path, std::filesystem::file_time_type::clock::now());
+        Cabinet::Fetch(result.Path, uri);
+        return result;
+    }
+
+    void Warehouse::CommitCabinet(Staged stage) {
+        const auto stock = mHome/WarehouseDir/WarehouseStockDir;
+        const auto ns = Cabinet::Open(stage.Path).Namespace();
+        const auto lock = mLocks.Acquire(LockTable::Scope::Cabinet, ns, Utils::FileLock::Exclusive);
+        // scan the namespace name against the list and the disk, another process may have taken it already.
+        // if there is conflict, throw a runtime error with message. the staged cabinet stays for a later retry
+        if (mCabinets.find(ns)!=mCabinets.end() || std::filesystem::exists(stock/ns)) Corruption(MsgCabinetConflict);
+        // move the cab, then load the cabinet into the list
+        std::filesystem::rename(stage.Path, stock/ns);
         Load(stock/ns);
     }
 
     void Warehouse::RemoveCabinet(const std::string& name) {
+        const Finally publish{[this]() { Publish(); }};
         const auto iter = mCabinets.find(name);
         if (iter==mCabinets.end()) return;
-        mCabinets.erase(iter);
+        std::unordered_set<std::string> users{};
+        {
+            const auto lock = mLocks.Acquire(LockTable::Scope::Cabinet, name, Utils::FileLock::Exclusive);
+            const auto home = iter->second.Home();
+            if (const auto i = mCabinetUsers.find(name); i!=mCabinetUsers.end()) {
+                users = std::move(i->second);
+                mCabinetUsers.erase(i);
+            }
+            mCabinets.erase(iter);
+            mTrash.Put(home);
+        }
+        // the users still hold modules of the cabinet, resolving them again lets go of those
+        ReloadWorkspaces(users);
+    }
+
+    void Warehouse::RemoveModule(const std::string& name) {
+        const Finally publish{[this]() { Publish(); }};
+        const auto ns = CabinetOf(name);
+        if (ns.empty()) return;
+        std::unordered_set<std::string> users{};
+        {
+            const auto cabLock = mLocks.Acquire(LockTable::Scope::Cabinet, ns, Utils::FileLock::Exclusive);
+            const auto modLock = mLocks.Acquire(LockTable::Scope::Module, name, Utils::FileLock::Exclusive);
+            if (const auto i = mModuleUsers.find(name); i!=mModuleUsers.end()) users = i->second;
+            GetCabinet(ns)->RemoveUnsafe(name.substr(ns.size()+1));
+        }
+        ReloadWorkspaces(users);
     }
 
     Cabinet* Warehouse::GetCabinet(const std::string& name) {
@@ -62,40 +165,229 @@ namespace Configure::Manager {
         return &i->second;
     }
 
-    void Warehouse::UpdateCabinet(const std::string& name) {
-        if (const auto cab = GetCabinet(name); cab) {
-            cab->UpdateUnsafe();
-            ReloadWorkspaces();
+    std::size_t Warehouse::PruneSnapshots() {
+        const auto mark = MarkSnapshots();
+        return mark.Live ? mSnapshots.Prune(*mark.Live) : 0;
+    }
+
+    Warehouse::SnapshotMark Warehouse::MarkSnapshots() {
+        // workspaces of other processes link snapshots too, so the mark is taken from what all of them recorded.
+        // a workspace holds the store lock from its first snapshot link until its info file is written
+        SnapshotMark mark{
+                mLocks.Acquire(LockTable::Scope::Snapshot, std::string(WarehouseSnapshotDir), Utils::FileLock::Exclusive),
+                std::unordered_set<std::string>{}
+        };
+        for (auto&& x : std::filesystem::directory_iterator(mHome/WarehouseDir/WarehouseWorkspaceDir)) {
+            const auto info = WorkspaceState(x.path());
+            if (!x.is_directory() || !std::filesystem::exists(info)) continue;
+            try {
+                for (auto&& [_, path] : LoadDocument(info)->at("checkout").items()) {
+                    const auto link = mHome/path.get<std::string>();
+                    if (!std::filesystem::is_symlink(std::filesystem::symlink_status(link))) continue;
+                    if (const auto target = std::filesystem::read_symlink(link); mSnapshots.Owns(target)) {
+                        mark.Live->insert(target.filename().string());
+                    }
+                }
+            }
+            catch (...) {
+                mark.Live.reset();
+                break;
+            }
         }
+        return mark;
     }
 
-    void Warehouse::UpdateCabinets() {
-        std::vector<std::nested_exception> transaction{};
-        try {
-            std::vector<std::nested_exception> updateErr{};
-            for (auto& x : mCabinets) {
-                try { x.second.UpdateUnsafe(); }
-                catch (...) { updateErr.emplace_back(); }
+    Warehouse::GcReport Warehouse::CollectGarbage(const bool dryRun) {
+        const auto base = mHome/WarehouseDir;
+        GcReport report{};
+        // every candidate is checked again and swept while its lock is held, another process may be using it
+        const auto sweep = [&report, dryRun, this](const std::filesystem::path& path) {
+            const auto status = std::filesystem::symlink_status(path);
+            if (std::filesystem::is_directory(status)) report.Bytes += Utils::TreeSize(path);
+            else if (std::filesystem::is_regular_file(status)) report.Bytes += std::filesystem::file_size(path);
+            report.Garbage.push_back(path);
+            if (!dryRun) mTrash.Put(path);
+        };
+        // mark from the cabinets as they are on disk, those of other processes included. a cabinet that cannot be
+        // read is not known to be garbage, the repositories in it are kept
+        for (auto&& x : std::filesystem::directory_iterator(base/WarehouseStockDir)) {
+            if (!x.is_directory()) continue;
+            const auto ns = x.path().filename().string();
+            const auto lock = mLocks.TryAcquire(LockTable::Scope::Cabinet, ns, Utils::FileLock::Exclusive);
+            if (!lock.Held() || !std::filesystem::exists(x.path()/ModulesPath)) continue;
+            auto cab = [&]() -> std::optional<Cabinet> {
+                try { return Cabinet::Open(x.path()); }
+                catch (...) { return std::nullopt; }
+            }();
+            if (!cab || cab->Namespace()!=ns) continue;
+            for (auto&& y : std::filesystem::directory_iterator(x.path()/ModulesPath)) {
+                if (!cab->Get(y.path().filename().string())) sweep(y.path());
             }
-            if (!updateErr.empty()) throw Utils::AggregateException(std::move(updateErr));
         }
-        catch (...) {
-            try { std::throw_with_nested(std::runtime_error("Failures during update:")); }
-            catch (...) { transaction.emplace_back(); }
+        // a workspace directory is only debris if its creation never got to write the info file
+        for (auto&& x : std::filesystem::directory_iterator(base/WarehouseWorkspaceDir)) {
+            const auto name = x.path().filename().string();
+            if (GetWorkspace(name) || std::filesystem::exists(WorkspaceState(x.path()))) continue;
+            const auto lock = mLocks.TryAcquire(LockTable::Scope::Workspace, name, Utils::FileLock::Exclusive);
+            if (lock.Held() && !std::filesystem::exists(WorkspaceState(x.path()))) sweep(x.path());
         }
-        try { ReloadWorkspaces(); }
-        catch (...) {
-            try { std::throw_with_nested(std::runtime_error("Failures during reload:")); }
-            catch (...) { transaction.emplace_back(); }
+        // manifest entries of an earlier layout, nothing reads them anymore
+        for (auto&& x : std::filesystem::directory_iterator(base/WarehouseManifestDir)) {
+            if (ManifestStore::Stale(x.path().filename().string())) sweep(x.path());
+        }
+        if (const auto mark = MarkSnapshots(); mark.Live) {
+            mSnapshots.Enumerate([&](const std::string& tree) {
+                if (mark.Live->find(tree)==mark.Live->end()) sweep(base/WarehouseSnapshotDir/tree);
+            });
+        }
+        // imports nobody came back to finish, and the same for the repositories of modules
+        const auto expired = [now = std::filesystem::file_time_type::clock::now(), this](const std::filesystem::path& path) {
+            std::error_code ec{};
+            const auto time = std::filesystem::last_write_time(path, ec);
+            return !ec && now-time>mStagingExpiry;
+        };
+        for (auto&& x : std::filesystem::directory_iterator(base/WarehousePartialDir)) {
+            if (!expired(x.path())) continue;
+            const auto lock = mLocks.TryAcquire(LockTable::Scope::Staging, x.path().filename().string(), Utils::FileLock::Exclusive);
+            if (lock.Held() && expired(x.path())) sweep(x.path());
+        }
+        for (auto&& [ns, cab] : mCabinets) {
+            cab.Enumerate([&, &ns = ns](Module& mod) {
+                const auto partial = mod.GetContentPath().parent_path()/RepoPartialPath;
+                if (!std::filesystem::exists(partial) || !expired(partial)) return;
+                const auto lock = mLocks.TryAcquire(LockTable::Scope::Module, ns+'.'+mod.Id(), Utils::FileLock::Exclusive);
+                if (lock.Held() && expired(partial)) sweep(partial);
+            });
+        }
+        // staging areas and dropped trees are named after the process working on them, their age says little as
+        // long operations need not touch the top directory. only what no running process can own is swept
+        const auto now = std::filesystem::file_time_type::clock::now();
+        for (auto&& x : std::filesystem::directory_iterator(base/WarehouseTempDir)) {
+            std::error_code ec{};
+            const auto time = std::filesystem::last_write_time(x.path(), ec);
+            if (!ec && now-time>TempGracePeriod && !Utils::NameInUse(x.path().filename().string())) sweep(x.path());
+        }
+        return report;
+    }
+
+    Warehouse::BuildLease Warehouse::AcquireBuildTree(const std::string& workspace, const std::string& module, const std::string& toolchain) {
+        const auto ws = GetWorkspace(workspace);
+        if (!ws) throw std::runtime_error("No such workspace: "+workspace);
+        // the inputs are only known for committed content, a tree with local edits builds privately
+        const auto mode = ws->Mode();
+        const auto immutable = mode==Materialize::Pinned || mode==Materialize::Snapshot;
+        bool identified = true;
+        const Resolver resolver{*this};
+        const auto treeOf = [&](const std::string& name) {
+            const auto mod = resolver.Find(name);
+            if (!mod || !mod->IsFull()) throw std::runtime_error("Module is not available locally: "+name);
+            auto repo = Git2::Repository::Open(mod->GetContentPath());
+            // immutable trees are the locked commits
+            if (immutable) {
+                const auto lock = ws->Locked().find(name);
+                if (lock!=ws->Locked().end() && !lock->second.empty()) return repo.TreeOf(lock->second);
+                identified = false;
+                return repo.TreeOf(repo.HeadOid());
+            }
+            // the others follow the shared work tree, whose HEAD may have moved since the lock was written.
+            // Private copies are only what HEAD says if they still match it
+            const auto copy = ws->CheckoutOf(name);
+            const auto copied = copy && (mode==Materialize::HardLink || mode==Materialize::Reflink);
+            if (!(copied ? repo.IsCleanAt(*copy) : repo.IsClean())) identified = false;
+            return repo.TreeOf(repo.HeadOid());
+        };
+        std::string closure{};
+        for (auto&& x : ws->Closure(module, resolver)) closure += x+' '+treeOf(x)+'\n';
+        const auto key = BuildCache::Key(treeOf(module), Git2::Hash(closure), toolchain);
+        if (!identified) return {{}, mBuilds.Stage(key), false};
+        // the entry must not be evicted between the lookup and the link
+        const auto use = mLocks.Acquire(LockTable::Scope::Build, key, Utils::FileLock::Shared);
+        if (const auto hit = mBuilds.Lookup(key); hit) {
+            LinkBuildTree(workspace, module, *hit);
+            return {key, *hit, true};
+        }
+        return {key, mBuilds.Stage(key), false};
+    }
+
+    void Warehouse::PublishBuildTree(const std::string& workspace, const std::string& module, const BuildLease& lease) {
+        if (lease.Hit) return;
+        if (!lease.Key.empty()) {
+            const auto use = mLocks.Acquire(LockTable::Scope::Build, lease.Key, Utils::FileLock::Shared);
+            return LinkBuildTree(workspace, module, mBuilds.Publish(lease.Path, lease.Key));
+        }
+        const auto target = mHome/WarehouseDir/WarehouseWorkspaceDir/workspace/BuildPath/module;
+        UnlinkBuildTree(target);
+        std::filesystem::create_directories(target.parent_path());
+        std::filesystem::rename(lease.Path, target);
+    }
+
+    void Warehouse::LinkBuildTree(const std::string& workspace, const std::string& module, const std::filesystem::path& output) {
+        const auto target = mHome/WarehouseDir/WarehouseWorkspaceDir/workspace/BuildPath/module;
+        UnlinkBuildTree(target);
+        std::filesystem::create_directories(target.parent_path());
+        std::filesystem::create_directory_symlink(std::filesystem::absolute(output), target);
+    }
+
+    std::unordered_set<std::string> Warehouse::LinkedBuildTrees() const {
+        std::unordered_set<std::string> result{};
+        for (auto&& ws : std::filesystem::directory_iterator(mHome/WarehouseDir/WarehouseWorkspaceDir)) {
+            std::error_code ec{};
+            for (auto&& x : std::filesystem::directory_iterator(ws.path()/BuildPath, ec)) {
+                if (!x.is_symlink()) continue;
+                result.insert(std::filesystem::read_symlink(x.path()).filename().string());
+            }
         }
-        if (!transaction.empty()) throw Utils::AggregateException(std::move(transaction));
+        return result;
+    }
+
+    void Warehouse::UnlinkBuildTree(const std::filesystem::path& path) {
+        const auto status = std::filesystem::symlink_status(path);
+        if (std::filesystem::is_symlink(status)) std::filesystem::remove(path);
+        else if (std::filesystem::is_directory(status)) std::filesystem::remove_all(path);
+    }
+
+    Module* Warehouse::FindModule(const std::string& name) {
+        const auto ns = CabinetOf(name);
+        if (ns.empty()) return nullptr;
+        return GetCabinet(ns)->Get(name.substr(ns.size()+1));
+    }
+
+    void Warehouse::UpdateCabinet(const std::string& name) {
+        const Finally publish{[this]() { Publish(); }};
+        if (const auto cab = GetCabinet(name); cab) {
+            {
+                const auto lock = mLocks.Acquire(LockTable::Scope::Cabinet, name, Utils::FileLock::Exclusive);
+                cab->UpdateUnsafe();
+            }
+            if (const auto i = mCabinetUsers.find(name); i!=mCabinetUsers.end()) ReloadWorkspaces(i->second);
+        }
+    }
+
+    void Warehouse::UpdateCabinets() {
+        const Finally publish{[this]() { Publish(); }};
+        Utils::ErrorList errors{};
+        for (auto& x : mCabinets) {
+            InterOp::Attempt(errors, x.first, "update", [&]() {
+                const auto lock = mLocks.Acquire(LockTable::Scope::Cabinet, x.first, Utils::FileLock::Exclusive);
+                x.second.UpdateUnsafe();
+            });
+            // readers see the refresh progress one cabinet at a time
+            Publish();
+        }
+        std::unordered_set<std::string> names{};
+        for (auto&& [name, _] : mWorkspaces) names.insert(name);
+        ReloadWorkspaces(names, errors);
+        if (!errors.Empty()) throw errors;
     }
 
     void Warehouse::RemoveWorkspace(const std::string& name) {
+        const Finally publish{[this]() { Publish(); }};
         const auto iter = mWorkspaces.find(name);
         if (iter==mWorkspaces.end()) return;
+        const auto lock = mLocks.Acquire(LockTable::Scope::Workspace, name, Utils::FileLock::Exclusive);
         iter->second.Destruct();
         mWorkspaces.erase(iter);
+        UnindexWorkspace(name);
     }
 
     Workspace* Warehouse::GetWorkspace(const std::string& name) {
@@ -104,17 +396,234 @@ namespace Configure::Manager {
         return &i->second;
     }
 
-    void Warehouse::CreateWorkspace(const Warehouse::CheckoutArgs& args) {
-        auto create = WorkspaceCheckoutHelper(*this, mHome, args);
-        mWorkspaces.insert_or_assign(args.Name, std::move(create));
+    void Warehouse::UpdateWorkspace(const std::string& name) {
+        const Finally publish{[this]() { Publish(); }};
+        if (const auto ws = GetWorkspace(name); ws) {
+            std::vector<std::tuple<std::string, Module*, std::string>> manifests{};
+            ws->Enumerate([&](const std::string& id, Module& mod, bool) {
+                manifests.emplace_back(id, &mod, ReadManifest(mod));
+            });
+            // metadata of all updated modules goes into the journal as one record, failed or not
+            Journal::Batch batch{};
+            Utils::ErrorList errors{};
+            InterOp::Attempt(errors, name, "update", [&]() {
+                const auto lock = mLocks.Acquire(LockTable::Scope::Workspace, name, Utils::FileLock::Exclusive);
+                ws->Update(batch, errors, Resolver{*this});
+            });
+            mJournal.Commit(std::move(batch));
+            // only the workspaces using a module whose manifest changed need to be resolved again
+            std::unordered_set<std::string> affected{};
+            for (auto&& [id, mod, manifest] : manifests) {
+                if (ReadManifest(*mod)==manifest) continue;
+                if (const auto i = mModuleUsers.find(id); i!=mModuleUsers.end()) affected.insert(i->second.begin(), i->second.end());
+            }
+            ReloadWorkspaces(affected, errors);
+            if (!errors.Empty()) throw errors;
+        }
+    }
+
+    void Warehouse::CreateWorkspace(const Warehouse::CheckoutArgs& args) { ReconcileWorkspace(args); }
+
+    std::vector<std::exception_ptr> Warehouse::CreateWorkspaces(const std::vector<CheckoutArgs>& batch) {
+        const Finally publish{[this]() { Publish(); }};
+        struct Job {
+            Workspace* Target{nullptr};
+            std::optional<Workspace> Created;
+            Workspace::RootMap Roots;
+            std::vector<ReconcileStep> Plan;
+            Utils::FileLock Lock;
+        };
+        std::vector<std::exception_ptr> errors(batch.size());
+        std::vector<Job> jobs(batch.size());
+        const Resolver resolver{*this};
+        // workspace locks are taken in name order, so batches racing in other processes cannot deadlock with us
+        std::vector<std::size_t> order(batch.size());
+        for (std::size_t i = 0; i<order.size(); ++i) order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](auto l, auto r) { return batch[l].Name<batch[r].Name; });
+        // resolve everything on this thread, the index and the manifests parsed for it are shared by the whole batch
+        std::unordered_set<std::string> names{};
+        for (const auto i : order) {
+            auto& args = batch[i];
+            auto& job = jobs[i];
+            try {
+                ValidateName(args.Name);
+                if (!names.insert(args.Name).second) throw std::runtime_error("Workspace "+args.Name+" given more than once");
+                job.Lock = mLocks.Acquire(LockTable::Scope::Workspace, args.Name, Utils::FileLock::Exclusive);
+                for (auto&& x : args.Modules) job.Roots.insert_or_assign(x.Name, x.InTree);
+                job.Target = GetWorkspace(args.Name);
+                if (!job.Target) job.Target = &job.Created.emplace(*this, args.Name, resolver);
+                job.Plan = job.Target->Plan(job.Roots, args.Mode, resolver);
+            }
+            catch (...) { errors[i] = std::current_exception(); }
+        }
+        // the link trees of distinct workspaces do not overlap, build them side by side
+        std::atomic<std::size_t> next{0};
+        const auto worker = [&]() {
+            for (auto i = next++; i<batch.size(); i = next++) {
+                if (errors[i]) continue;
+                try { jobs[i].Target->Apply(jobs[i].Roots, batch[i].Mode, jobs[i].Plan, resolver); }
+                catch (...) { errors[i] = std::current_exception(); }
+            }
+        };
+        std::vector<std::thread> workers{};
+        const auto count = std::min<std::size_t>(std::max(1u, std::thread::hardware_concurrency()), batch.size());
+        for (std::size_t i = 1; i<count; ++i) workers.emplace_back(worker);
+        worker();
+        for (auto&& x : workers) x.join();
+        for (std::size_t i = 0; i<batch.size(); ++i) {
+            if (errors[i]) continue;
+            auto& job = jobs[i];
+            if (job.Created) job.Target = &mWorkspaces.insert_or_assign(batch[i].Name, std::move(*job.Created)).first->second;
+            IndexWorkspace(*job.Target);
+        }
+        return errors;
+    }
+
+    std::vector<ReconcileStep> Warehouse::ReconcileWorkspace(const CheckoutArgs& args, const bool dryRun) {
+        return Reconcile(args, dryRun, nullptr);
+    }
+
+    void Warehouse::CheckoutFrozen(const std::string& name, const std::filesystem::path& lockFile) {
+        const auto document = LoadDocument(lockFile);
+        const auto& list = *document;
+        CheckoutArgs args{name, {}, Materialize::Pinned};
+        for (auto&& [mod, root] : list.at("roots").items()) args.Modules.push_back({mod, root.at("inTree").get<bool>()});
+        // everything has to be present in the local object databases, nothing is ever fetched here
+        Workspace::PinMap pins{};
+        std::string missing{}, unknown{};
+        for (auto&& [mod, entry] : list.at("modules").items()) {
+            const std::string commit = entry.at("commit");
+            if (commit.empty()) {
+                unknown += ' '+mod;
+                continue;
+            }
+            const auto target = FindModule(mod);
+            if (!target || !target->IsFull() || !Git2::Repository::Open(target->GetContentPath()).Contains(commit)) {
+                missing += ' '+mod+'@'+commit;
+            }
+            pins.insert_or_assign(mod, commit);
+        }
+        if (!unknown.empty()) throw std::runtime_error(std::string(MsgLockedRevisionUnknown)+unknown);
+        if (!missing.empty()) throw std::runtime_error(std::string(MsgLockedRevisionMissing)+missing);
+        Reconcile(args, false, &pins);
+    }
+
+    std::vector<ReconcileStep> Warehouse::Reconcile(const CheckoutArgs& args, const bool dryRun, const Workspace::PinMap* pins) {
+        const Finally publish{[this]() { Publish(); }};
+        ValidateName(args.Name);
+        const auto lock = mLocks.Acquire(
+                LockTable::Scope::Workspace, args.Name, dryRun ? Utils::FileLock::Shared : Utils::FileLock::Exclusive
+        );
+        Workspace::RootMap roots{};
+        for (auto&& x : args.Modules) roots.insert_or_assign(x.Name, x.InTree);
+        const Resolver resolver{*this};
+        if (const auto ws = GetWorkspace(args.Name); ws) {
+            if (pins) ws->Pin(*pins);
+            auto plan = ws->Plan(roots, args.Mode, resolver);
+            if (!dryRun) {
+                ws->Apply(roots, args.Mode, plan, resolver);
+                IndexWorkspace(*ws);
+            }
+            return plan;
+        }
+        // a new workspace is an empty one reconciled against the requested roots
+        auto create = Workspace(*this, args.Name, resolver);
+        if (pins) create.Pin(*pins);
+        auto plan = create.Plan(roots, args.Mode, resolver);
+        if (!dryRun) {
+            create.Apply(roots, args.Mode, plan, resolver);
+            IndexWorkspace(mWorkspaces.insert_or_assign(args.Name, std::move(create)).first->second);
+        }
+        return plan;
     }
 
     void Warehouse::ReloadWorkspaces() {
-        std::vector<std::nested_exception> exceptions{};
-        for (auto& m : mWorkspaces) {
-            try { m.second.Reload(); }
-            catch (...) { exceptions.emplace_back(); }
+        std::unordered_set<std::string> names{};
+        for (auto&& [name, _] : mWorkspaces) names.insert(name);
+        ReloadWorkspaces(names);
+    }
+
+    void Warehouse::ReloadWorkspaces(const std::unordered_set<std::string>& names) {
+        Utils::ErrorList errors{};
+        ReloadWorkspaces(names, errors);
+        if (!errors.Empty()) throw errors;
+    }
+
+    void Warehouse::ReloadWorkspaces(const std::unordered_set<std::string>& names, Utils::ErrorList& errors) {
+        // one index of the cabinets and one parse of each manifest for all of them
+        std::optional<Resolver> resolver{};
+        for (auto&& name : std::vector<std::string>(names.begin(), names.end())) {
+            const auto ws = GetWorkspace(name);
+            if (!ws) continue;
+            if (!resolver) resolver.emplace(*this);
+            InterOp::Attempt(errors, name, "reload", [&]() {
+                const auto lock = mLocks.Acquire(LockTable::Scope::Workspace, name, Utils::FileLock::Exclusive);
+                ws->Reload(*resolver);
+                IndexWorkspace(*ws);
+            });
+        }
+    }
+
+    void Warehouse::IndexWorkspace(Workspace& workspace) {
+        UnindexWorkspace(workspace.Name());
+        std::unordered_set<std::string> refs{};
+        workspace.EnumerateRoots([&](const std::string& id, bool) { refs.insert(id); });
+        workspace.Enumerate([&](const std::string& id, Module&, bool) { refs.insert(id); });
+        for (auto&& id : refs) {
+            mModuleUsers[id].insert(workspace.Name());
+            if (auto ns = CabinetOf(id); !ns.empty()) mCabinetUsers[ns].insert(workspace.Name());
+        }
+        mWorkspaceRefs.insert_or_assign(workspace.Name(), std::vector<std::string>(refs.begin(), refs.end()));
+    }
+
+    void Warehouse::UnindexWorkspace(const std::string& name) {
+        const auto iter = mWorkspaceRefs.find(name);
+        if (iter==mWorkspaceRefs.end()) return;
+        const auto drop = [&name](auto& index, const std::string& key) {
+            if (const auto i = index.find(key); i!=index.end() && (i->second.erase(name), i->second.empty())) index.erase(i);
+        };
+        for (auto&& id : iter->second) {
+            drop(mModuleUsers, id);
+            drop(mCabinetUsers, CabinetOf(id));
+        }
+        mWorkspaceRefs.erase(iter);
+    }
+
+    std::string Warehouse::CabinetOf(const std::string& module) const {
+        // namespaces may contain dots themselves, so match against the known ones instead of splitting
+        for (auto&& [ns, _] : mCabinets) {
+            if (module.size()>ns.size() && module[ns.size()]=='.' && module.compare(0, ns.size(), ns)==0) return ns;
+        }
+        return {};
+    }
+
+    void Warehouse::Publish() noexcept {
+        try {
+            auto view = std::make_shared<WarehouseView>();
+            const auto last = std::atomic_load(&mView);
+            view->Version = last ? last->Version+1 : 0;
+            for (auto&& [ns, cab] : mCabinets) {
+                auto& modules = view->Cabinets[ns];
+                cab.Enumerate([&modules](Module& mod) {
+                    modules.insert_or_assign(mod.Id(), WarehouseView::ModuleView{
+                            mod.Id(), mod.Uri(), mod.Display(), mod.IsFull(), mod.LastUpdate(), mod.LastCommit()
+                    });
+                });
+            }
+            for (auto&& [name, ws] : mWorkspaces) {
+                auto& target = view->Workspaces[name];
+                target.Mode = ws.Mode();
+                ws.EnumerateRoots([&](const std::string& mod, bool inTree) { target.Roots.insert_or_assign(mod, inTree); });
+                ws.EnumerateCheckout([&](const std::string& mod, const std::filesystem::path& path) {
+                    target.Checkout.insert_or_assign(mod, path);
+                });
+                target.Locked = ws.Locked();
+                target.Stats = ws.Stats();
+            }
+            std::atomic_store(&mView, std::shared_ptr<const WarehouseView>(std::move(view)));
+        }
+        catch (...) {
+            // readers keep the last view, the next change publishes everything again
         }
-        if (!exceptions.empty()) throw Utils::AggregateException(std::move(exceptions));
     }
 }
\ No newline at end of file
@@ -1,123 +1,411 @@
 #include <utility>
+#include <ostream>
+#include <algorithm>
 
 #include "InterOp.h"
 #include "Json/Json.h"
-#include "Utils/Exception.h"
+#include "Metadata.h"
+#include "Git2/Repository.h"
 
 using namespace Configure::Manager::InterOp;
 
 namespace Configure::Manager {
     namespace {
-        class Checkout {
-        public:
-            explicit Checkout(
-                    Warehouse& warehouse,
-                    std::filesystem::path home,
-                    const Warehouse::CheckoutArgs& args
-            ) noexcept
-                    :mrHouse(warehouse), mrArgs(args), mHome(std::move(home)) { }
-
-            Workspace Run() {
-                ValidateName(mrArgs.Name);
-                IndexModules();
-                ResolveRequests();
-                PathLink();
-                WriteOut();
-                return Workspace(mHome / mrArgs.Name);
+        using CheckoutMap = Resolver::CheckoutMap;
+        using RootMap = Resolver::RootMap;
+        using PinMap = Resolver::PinMap;
+
+        using ModuleList = std::vector<std::tuple<std::string, Module*, bool>>;
+        using StatsMap = std::unordered_map<std::string, Utils::CloneStats>;
+
+        constexpr std::string_view ModeNames[] = {"symlink", "hardlink", "reflink", "pinned", "snapshot"};
+
+        Materialize ModeOf(const nlohmann::json& list) {
+            const auto x = list.find("mode");
+            if (x==list.end()) return Materialize::Symlink;
+            for (std::size_t i = 0; i<std::size(ModeNames); ++i) if (*x==ModeNames[i]) return static_cast<Materialize>(i);
+            Corruption("Unknown Workspace Materialization Mode");
+        }
+
+        ModuleList MakeList(const Resolver& resolver, const CheckoutMap& checkout, const RootMap& roots) {
+            ModuleList result{};
+            for (auto&& [name, _] : checkout) {
+                if (const auto mod = resolver.Find(name); mod) result.emplace_back(name, mod, roots.find(name)!=roots.end());
             }
-        private:
-            void IndexModules() {
-                mrHouse.EnumerateCabinets([this](Cabinet& cab) {
-                    cab.Enumerate([this, prefix = cab.Namespace()+'.'](Module& mod) {
-                        mIndex.insert_or_assign(prefix+mod.Id(), &mod);
-                    });
-                });
+            return result;
+        }
+
+        void WriteOut(
+                const std::filesystem::path& home, const std::string& name, Materialize mode,
+                const RootMap& roots, const CheckoutMap& checkout, const StatsMap& stats
+        ) {
+            auto list = nlohmann::json::object();
+            list["mode"] = ModeNames[static_cast<int>(mode)];
+            auto paths = nlohmann::json::object();
+            for (auto&& [mod, path] : checkout) paths[mod] = path.lexically_proximate(home).generic_string();
+            list["checkout"] = std::move(paths);
+            auto rootList = nlohmann::json::object();
+            for (auto&& [mod, inTree] : roots) {
+                auto root = nlohmann::json::object();
+                root["inTree"] = inTree;
+                rootList[mod] = root;
+            }
+            list["roots"]=std::move(rootList);
+            if (mode!=Materialize::Symlink) {
+                auto statList = nlohmann::json::object();
+                for (auto&& [mod, x] : stats) statList[mod] = {x.Copied, x.Shared};
+                list["stats"] = std::move(statList);
             }
+            const auto dir = home/WarehouseDir/WarehouseWorkspaceDir/name;
+            Json::Save(dir/WorkspaceStatePath, list, Json::Format::Cbor);
+            std::error_code ec{};
+            std::filesystem::remove(dir/InfoPath, ec);
+        }
 
-            void ResolveRequests() {
-                const auto ws = mHome/mrArgs.Name;
-                const auto wsIn = mHome/WarehouseDir/WarehouseWorkspaceDir/mrArgs.Name;
-                std::filesystem::create_directories(ws);
-                std::filesystem::create_directories(wsIn);
-                for (auto&& x : mrArgs.Modules) {
-                    if (const auto i = mIndex.find(x.Name); i!=mIndex.end()) {
-                        // insert the requested module itself
-                        mRequests.insert_or_assign(x.Name, x.InTree ? ws/i->second->Id() : wsIn/x.Name);
-                    }
-                }
-                for (auto&& x : mrArgs.Modules) {
-                    if (const auto i = mIndex.find(x.Name); i!=mIndex.end()) {
-                        const auto mif = i->second->GetContentPath()/"module.json";
-                        const auto list = Json::Load(mif);
-                        const std::unordered_map<std::string, std::string> imports = list["import"];
-                        std::vector<std::string> depends = list["depends"];
-                        // try resolve all dependency names
-                        for (auto&& y: depends) {
-                            std::string rKey{}, rRep;
-                            for (auto&&[key, rep]:  imports) {
-                                if (y.find(key)==0) if (key.length()>rKey.length()) (rKey = key, rRep = rep); // NOLINT
-                            }
-                            if (!rKey.empty()) y = rRep+y.substr(rKey.length()); // NOLINT
-                        }
-                        for (auto&& y: depends) {
-                            if (mIndex.find(y)!=mIndex.end()) mRequests.insert_or_assign(y, wsIn/y);
-                        }
-                    }
-                }
+        void WriteLock(
+                const std::filesystem::path& home, const std::string& name, Materialize mode,
+                const RootMap& roots, const Resolver& resolver, const PinMap& lock
+        ) {
+            auto list = nlohmann::json::object();
+            list["mode"] = ModeNames[static_cast<int>(mode)];
+            auto rootList = nlohmann::json::object();
+            for (auto&& [mod, inTree] : roots) rootList[mod] = {{"inTree", inTree}};
+            list["roots"] = std::move(rootList);
+            auto modules = nlohmann::json::object();
+            for (auto&& [mod, commit] : lock) {
+                const auto target = resolver.Find(mod);
+                modules[mod] = {{"uri", target ? target->Uri() : std::string{}}, {"commit", commit}};
             }
+            list["modules"] = std::move(modules);
+            Json::Save(home/WarehouseDir/WarehouseWorkspaceDir/name/LockPath, list);
+        }
 
-            void PathLink() {
-                for (auto&&[uri, pth]: mRequests) {
-                    std::filesystem::create_directory_symlink(mIndex[uri]->GetContentPath(), pth);
-                }
+        bool Present(Materialize mode, const std::filesystem::path& path) {
+            const auto status = std::filesystem::symlink_status(path);
+            if (mode==Materialize::Symlink || mode==Materialize::Snapshot) return std::filesystem::is_symlink(status);
+            return std::filesystem::is_directory(status);
+        }
+
+        Utils::CloneStats Link(
+                Warehouse& house, Materialize mode, const Module& mod,
+                const std::filesystem::path& path, const std::string& commit
+        ) {
+            std::filesystem::create_directories(path.parent_path());
+            switch (mode) {
+            case Materialize::Snapshot: {
+                Utils::CloneStats stats{};
+                const auto snapshot = house.Snapshots().Acquire(mod.GetContentPath(), commit, stats);
+                std::filesystem::create_directory_symlink(snapshot, path);
+                return stats;
+            }
+            case Materialize::Pinned:
+                Git2::Repository::Open(mod.GetContentPath()).CheckoutTo(commit, path);
+                return {Utils::TreeSize(path), 0};
+            case Materialize::HardLink:
+                return Utils::CloneTree(mod.GetContentPath(), path, Utils::CloneMode::HardLink, ".git");
+            case Materialize::Reflink:
+                return Utils::CloneTree(mod.GetContentPath(), path, Utils::CloneMode::Reflink, ".git");
+            default:
+                std::filesystem::create_directory_symlink(mod.GetContentPath(), path);
+                return {};
             }
+        }
 
-            void WriteOut() {
-                auto list = nlohmann::json::object();
-                for (auto&& [_, x] : mRequests) x = x.lexically_proximate(mHome);
-                list["checkout"] = mRequests;
-                auto roots = nlohmann::json::object();
-                for (auto&& x : mrArgs.Modules) {
-                    auto root = nlohmann::json::object();
-                    root["inTree"] = x.InTree;
-                    roots[x.Name] = root;
-                }
-                list["roots"]=std::move(roots);
-                Json::Save(mHome/WarehouseDir/WarehouseWorkspaceDir/mrArgs.Name/InfoPath, list);
+        // the collector marks snapshots from the info files with the store lock held exclusively. whoever links one
+        // holds it shared until the link is on record
+        Utils::FileLock HoldSnapshots(Warehouse& house, Materialize mode) {
+            if (mode!=Materialize::Snapshot) return {};
+            return house.Locks().Acquire(LockTable::Scope::Snapshot, std::string(WarehouseSnapshotDir), Utils::FileLock::Shared);
+        }
+
+        // only for paths recorded in the checkout of the workspace, a real tree there is one the workspace made
+        void Unlink(Materialize mode, const std::filesystem::path& path) {
+            const auto status = std::filesystem::symlink_status(path);
+            if (std::filesystem::is_symlink(status)) std::filesystem::remove(path);
+            else if (mode!=Materialize::Symlink && std::filesystem::is_directory(status)) std::filesystem::remove_all(path);
+        }
+
+        // whether something that is not ours holds the path, a link or an empty directory loses nothing if replaced
+        bool Occupied(const std::filesystem::path& path) {
+            const auto status = std::filesystem::symlink_status(path);
+            if (!std::filesystem::exists(status) || std::filesystem::is_symlink(status)) return false;
+            return !std::filesystem::is_directory(status) || !std::filesystem::is_empty(path);
+        }
+
+        void Vacate(const std::filesystem::path& path) {
+            if (Occupied(path)) throw std::runtime_error("Path is in the way of a checkout: "+path.string());
+            std::filesystem::remove(path);
+        }
+    }
+
+    Resolver::Resolver(Warehouse& warehouse)
+            :mManifests(&warehouse.Manifests()) {
+        warehouse.EnumerateCabinets([this](Cabinet& cab) {
+            cab.Enumerate([this, prefix = cab.Namespace()+'.'](Module& mod) {
+                mIndex.insert_or_assign(prefix+mod.Id(), &mod);
+            });
+        });
+    }
+
+    Module* Resolver::Find(const std::string& name) const {
+        const auto i = mIndex.find(name);
+        return i!=mIndex.end() ? i->second : nullptr;
+    }
+
+    Resolver::CheckoutMap Resolver::Resolve(const std::filesystem::path& home, const std::string& name, const RootMap& roots) const {
+        CheckoutMap requests{};
+        const auto ws = (home/name).lexically_normal();
+        const auto wsIn = (home/WarehouseDir/WarehouseWorkspaceDir/name).lexically_normal();
+        for (auto&& [root, inTree] : roots) {
+            if (const auto mod = Find(root); mod) {
+                // insert the requested module itself
+                requests.insert_or_assign(root, inTree ? ws/mod->Id() : wsIn/root);
+            }
+        }
+        for (auto&& [root, _] : roots) {
+            if (const auto mod = Find(root); mod) {
+                for (auto&& y: Dependencies(*mod)) requests.try_emplace(y, wsIn/y);
             }
+        }
+        return requests;
+    }
 
-            Warehouse& mrHouse;
-            std::filesystem::path mHome;
-            const Warehouse::CheckoutArgs& mrArgs;
-            std::unordered_map<std::string, Module*> mIndex;
-            std::unordered_map<std::string, std::filesystem::path> mRequests;
-        };
+    const std::vector<std::string>& Resolver::Dependencies(const Module& mod) const {
+        // every workspace of a batch shares the manifests, each one is only parsed once
+        if (const auto i = mDepends.find(&mod); i!=mDepends.end()) return i->second;
+        return mDepends.insert_or_assign(&mod, Known(LoadModuleManifest(mod.GetContentPath()/ManifestPath))).first->second;
     }
 
-    Workspace::Workspace(const std::filesystem::path& home) {
+    std::vector<std::string> Resolver::Dependencies(const Module& mod, const std::string& commit) const {
+        auto manifest = mManifests->At(mod.GetContentPath(), commit);
+        return manifest ? Known(std::move(*manifest)) : std::vector<std::string>{};
+    }
 
+    std::vector<std::string> Resolver::Known(ModuleManifest manifest) const {
+        const auto& imports = manifest.Import;
+        auto& depends = manifest.Depends;
+        // try resolve all dependency names
+        for (auto&& y: depends) {
+            std::string rKey{}, rRep;
+            for (auto&&[key, rep]:  imports) {
+                if (y.find(key)==0) if (key.length()>rKey.length()) (rKey = key, rRep = rep); // NOLINT
+            }
+            if (!rKey.empty()) y = rRep+y.substr(rKey.length()); // NOLINT
+        }
+        depends.erase(std::remove_if(depends.begin(), depends.end(), [this](auto& y) { return !Find(y); }), depends.end());
+        return std::move(depends);
     }
 
-    void Workspace::Reload() {
+    Resolver::CheckoutMap Resolver::Place(const std::filesystem::path& home, const std::string& name, const RootMap& roots, const PinMap& pins) const {
+        CheckoutMap requests{};
+        const auto ws = (home/name).lexically_normal();
+        const auto wsIn = (home/WarehouseDir/WarehouseWorkspaceDir/name).lexically_normal();
+        for (auto&& [id, _] : pins) {
+            const auto mod = Find(id);
+            if (!mod) continue;
+            const auto root = roots.find(id);
+            requests.insert_or_assign(id, root!=roots.end() && root->second ? ws/mod->Id() : wsIn/id);
+        }
+        return requests;
+    }
+
+    Workspace::Workspace(Warehouse& warehouse, std::string name): Workspace(warehouse, std::move(name), Resolver{warehouse}) {}
+
+    Workspace::Workspace(Warehouse& warehouse, std::string name, const Resolver& resolver)
+            :mHouse(&warehouse), mName(std::move(name)), mMode(Materialize::Symlink) {
+        const auto& home = mHouse->Home();
+        const auto info = WorkspaceState(home/WarehouseDir/WarehouseWorkspaceDir/mName);
+        if (!std::filesystem::exists(info)) return;
+        const auto document = LoadDocument(info);
+        const auto& list = *document;
+        mMode = ModeOf(list);
+        for (auto&& [mod, root] : list.at("roots").items()) mRoots.insert_or_assign(mod, root.at("inTree").get<bool>());
+        for (auto&& [mod, path] : list.at("checkout").items()) {
+            mCheckout.insert_or_assign(mod, (home/path.get<std::string>()).lexically_normal());
+        }
+        if (const auto x = list.find("stats"); x!=list.end()) {
+            for (auto&& [mod, stat] : x->items()) mStats.insert_or_assign(mod, Utils::CloneStats{stat.at(0), stat.at(1)});
+        }
+        if (const auto lock = info.parent_path()/LockPath; std::filesystem::exists(lock)) {
+            for (auto&& [mod, entry] : LoadDocument(lock)->at("modules").items()) mLock.insert_or_assign(mod, entry.at("commit"));
+        }
+        if (mMode==Materialize::Pinned) mPins = mLock;
+        mList = MakeList(resolver, mCheckout, mRoots);
+    }
+
+    std::optional<std::filesystem::path> Workspace::CheckoutOf(const std::string& module) const {
+        if (const auto i = mCheckout.find(module); i!=mCheckout.end()) return i->second;
+        return std::nullopt;
+    }
 
+    Utils::CloneStats Workspace::Stats() const noexcept {
+        Utils::CloneStats result{};
+        for (auto&& [_, x] : mStats) result += x;
+        return result;
     }
 
-    void Workspace::Update() {
-        std::vector<std::nested_exception> exceptions{};
-        for (auto& m : mList) {
-            try { std::get<1>(m)->Update(); }
-            catch (...) { exceptions.emplace_back(); }
+    std::vector<ReconcileStep> Workspace::Plan(const RootMap& roots, const Materialize mode) const {
+        return Plan(roots, mode, Resolver{*mHouse});
+    }
+
+    std::vector<ReconcileStep> Workspace::Plan(const RootMap& roots, const Materialize mode, const Resolver& resolver) const {
+        const auto pinned = mode==Materialize::Pinned;
+        const auto next = pinned ? resolver.Place(mHouse->Home(), mName, roots, mPins) : resolver.Resolve(mHouse->Home(), mName, roots);
+        std::vector<ReconcileStep> plan{};
+        for (auto&& [name, path] : mCheckout) {
+            if (next.find(name)==next.end()) plan.push_back({ReconcileStep::Unlink, name, path, {}});
+        }
+        for (auto&& [name, path] : next) {
+            const auto i = mCheckout.find(name);
+            if (i==mCheckout.end()) {
+                plan.push_back({ReconcileStep::Link, name, {}, path});
+                continue;
+            }
+            // entries that moved, changed representation or went missing on disk are made again
+            const auto lock = mLock.find(name);
+            const auto repin = pinned && (lock==mLock.end() || lock->second!=mPins.at(name));
+            if (i->second!=path || mode!=mMode || repin || !Present(mMode, path)) {
+                plan.push_back({ReconcileStep::Relink, name, i->second, path});
+            }
         }
-        if (!exceptions.empty()) throw Utils::AggregateException(std::move(exceptions));
+        return plan;
     }
 
-    namespace InterOp {
-        Workspace WorkspaceCheckoutHelper(
-                Warehouse& warehouse,
-                const std::filesystem::path& home,
-                const Warehouse::CheckoutArgs& args
-        ) {
-            return Checkout(warehouse, home, args).Run();
+    void Workspace::Apply(const RootMap& roots, const Materialize mode, const std::vector<ReconcileStep>& plan) {
+        Apply(roots, mode, plan, Resolver{*mHouse});
+    }
+
+    void Workspace::Apply(
+            const RootMap& roots, const Materialize mode, const std::vector<ReconcileStep>& plan, const Resolver& resolver
+    ) {
+        const auto& home = mHouse->Home();
+        const auto internal = home/WarehouseDir/WarehouseWorkspaceDir/mName;
+        const auto changed = !plan.empty() || roots!=mRoots || mode!=mMode || !std::filesystem::exists(WorkspaceState(internal));
+        // trees of our own are only known by the checkout, what else is found where a module goes is left alone
+        std::unordered_set<std::string> released{};
+        for (auto&& x : plan) if (x.Action!=ReconcileStep::Link) released.insert(x.From.string());
+        for (auto&& x : plan) {
+            if (x.Action==ReconcileStep::Unlink || released.count(x.To.string())) continue;
+            if (Occupied(x.To)) throw std::runtime_error("Path is in the way of a checkout: "+x.To.string());
+        }
+        const auto snapshots = HoldSnapshots(*mHouse, mode);
+        std::filesystem::create_directories(home/mName);
+        std::filesystem::create_directories(internal);
+        // unlink everything first so that a path given up by one module can be taken by another
+        for (auto&& x : plan) {
+            if (x.Action==ReconcileStep::Link) continue;
+            Unlink(mMode, x.From);
+            mStats.erase(x.Module);
+            mCheckout.erase(x.Module);
+            mLock.erase(x.Module);
+        }
+        for (auto&& x : plan) {
+            if (x.Action==ReconcileStep::Unlink) continue;
+            const auto mod = resolver.Find(x.Module);
+            if (!mod) continue;
+            // the module tree must not move under us while it is linked, pulls into it take the lock exclusively
+            const auto lock = mHouse->Locks().Acquire(LockTable::Scope::Module, x.Module, Utils::FileLock::Shared);
+            Vacate(x.To);
+            const auto commit = mode==Materialize::Pinned ? mPins.at(x.Module) : mod->Revision();
+            mStats.insert_or_assign(x.Module, Link(*mHouse, mode, *mod, x.To, commit));
+            mCheckout.insert_or_assign(x.Module, x.To);
+            // a module not fetched yet is locked at no commit, a frozen checkout of the lock refuses it
+            mLock.insert_or_assign(x.Module, commit);
+        }
+        mRoots = roots;
+        mMode = mode;
+        mList = MakeList(resolver, mCheckout, mRoots);
+        if (changed) {
+            WriteOut(home, mName, mMode, mRoots, mCheckout, mStats);
+            WriteLock(home, mName, mMode, mRoots, resolver, mLock);
+        }
+    }
+
+    std::vector<std::string> Workspace::Closure(const std::string& module) const { return Closure(module, Resolver{*mHouse}); }
+
+    std::vector<std::string> Workspace::Closure(const std::string& module, const Resolver& resolver) const {
+        // trees of immutable workspaces are the locked commits, their manifests may differ from the work trees
+        const auto immutable = mMode==Materialize::Pinned || mMode==Materialize::Snapshot;
+        std::unordered_set<std::string> seen{module};
+        std::vector<std::string> queue{module};
+        while (!queue.empty()) {
+            const auto name = std::move(queue.back());
+            queue.pop_back();
+            const auto mod = resolver.Find(name);
+            if (!mod) continue;
+            if (const auto lock = mLock.find(name); immutable && lock!=mLock.end() && !lock->second.empty()) {
+                for (auto&& x : resolver.Dependencies(*mod, lock->second)) if (seen.insert(x).second) queue.push_back(x);
+                continue;
+            }
+            if (!std::filesystem::exists(mod->GetContentPath()/ManifestPath)) continue;
+            for (auto&& x : resolver.Dependencies(*mod)) if (seen.insert(x).second) queue.push_back(x);
+        }
+        seen.erase(module);
+        std::vector<std::string> result{seen.begin(), seen.end()};
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    void Workspace::Reload() { Reload(Resolver{*mHouse}); }
+
+    void Workspace::Reload(const Resolver& resolver) {
+        // modules removed from the warehouse are gone from the list before anything can fail
+        mList = MakeList(resolver, mCheckout, mRoots);
+        Apply(mRoots, mMode, Plan(mRoots, mMode, resolver), resolver);
+    }
+
+    void Workspace::Destruct() {
+        const auto& home = mHouse->Home();
+        for (auto&& [_, path] : mCheckout) Unlink(mMode, path);
+        // the workspace directory only goes if nothing but our own links was placed in there
+        std::error_code ec{};
+        std::filesystem::remove(home/mName, ec);
+        Utils::RemoveTree(home/WarehouseDir/WarehouseWorkspaceDir/mName);
+        mCheckout.clear();
+        mStats.clear();
+        mLock.clear();
+        mList.clear();
+    }
+
+    void Workspace::Update(Journal::Batch& batch, Utils::ErrorList& errors) { Update(batch, errors, Resolver{*mHouse}); }
+
+    void Workspace::Update(Journal::Batch& batch, Utils::ErrorList& errors, const Resolver& resolver) {
+        const auto snapshots = HoldSnapshots(*mHouse, mMode);
+        bool changed = false;
+        for (auto& [name, mod, _] : mList) {
+            InterOp::Attempt(errors, name, "update", [&, &name = name, &mod = mod]() {
+                const auto lock = mHouse->Locks().Acquire(LockTable::Scope::Module, name, Utils::FileLock::Exclusive);
+                mod->Update();
+                mod->Persist(batch);
+                // pinned trees stay at their commit, the update only brings in new objects
+                if (mMode==Materialize::Pinned) return;
+                const auto commit = mod->Revision();
+                // real trees do not follow the working tree, bring them up to date with it
+                if (mMode!=Materialize::Symlink) {
+                    const auto& path = mCheckout.at(name);
+                    Unlink(mMode, path);
+                    mStats.insert_or_assign(name, Link(*mHouse, mMode, *mod, path, commit));
+                }
+                mLock.insert_or_assign(name, commit);
+                changed = true;
+            });
+        }
+        if (changed) {
+            const auto& home = mHouse->Home();
+            WriteOut(home, mName, mMode, mRoots, mCheckout, mStats);
+            WriteLock(home, mName, mMode, mRoots, resolver, mLock);
+        }
+    }
+
+    std::ostream& operator<<(std::ostream& out, const ReconcileStep& step) {
+        switch (step.Action) {
+        case ReconcileStep::Link:
+            return out << "link   " << step.Module << " -> " << step.To.generic_string();
+        case ReconcileStep::Unlink:
+            return out << "unlink " << step.Module << " -x " << step.From.generic_string();
+        default:
+            return out << "relink " << step.Module << " -> " << step.To.generic_string()
+                       << " (was " << step.From.generic_string() << ")";
         }
     }
 }
\ No newline at end of file
@@ -0,0 +1,38 @@
+#include "ErrorList.h"
+
+namespace Utils {
+    const char* ErrorList::what() const noexcept {
+        try {
+            std::call_once(mText->Once, [this]() {
+                auto& text = mText->Value;
+                std::size_t size = 32;
+                for (auto&& x : mRecords) size += x.Target.size()+x.Operation.size()+x.Message.size()+32;
+                text.reserve(size);
+                text.append(std::to_string(mRecords.size())).append(mRecords.size()==1 ? " failure" : " failures");
+                for (auto&& x : mRecords) {
+                    text.append("\n\t").append(x.Operation).append(1, ' ').append(x.Target).append(": ").append(x.Message);
+                    if (x.Code) text.append(" (git ").append(std::to_string(x.Code)).append(1, '/').append(std::to_string(x.Klass)).append(1, ')');
+                }
+            });
+            return mText->Value.c_str();
+        }
+        catch (...) {
+            return "failures, out of memory for the message";
+        }
+    }
+
+    nlohmann::json ErrorList::ToJson() const {
+        auto result = nlohmann::json::array();
+        for (auto&& x : mRecords) {
+            nlohmann::json record{
+                    {"target", x.Target}, {"operation", x.Operation}, {"message", x.Message}, {"durationNs", x.Duration.count()}
+            };
+            if (x.Code) {
+                record["code"] = x.Code;
+                record["class"] = x.Klass;
+            }
+            result.push_back(std::move(record));
+        }
+        return result;
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <exception>
+#include <string_view>
+#include "Json/Json.h"
+
+namespace Utils {
+    // Failures of a batch of independent operations, one record per failed item.
+    // Records keep what failed as data. The text of what() is only put together when it is asked for, and then once,
+    // so collecting many failures costs no more than the records themselves. Thrown as is once the batch is through
+    class ErrorList: public std::exception {
+    public:
+        struct Record {
+            std::string Target;
+            // a literal naming the step that failed, such as "update"
+            std::string_view Operation;
+            std::string Message;
+            // error code and class from libgit2, both 0 for failures that did not come from there
+            int Code{0}, Klass{0};
+            std::chrono::nanoseconds Duration{0};
+        };
+
+        void Add(Record record) { mRecords.push_back(std::move(record)); }
+        [[nodiscard]] bool Empty() const noexcept { return mRecords.empty(); }
+        [[nodiscard]] auto& Records() const noexcept { return mRecords; }
+        [[nodiscard]] const char* what() const noexcept override;
+        // [{"target", "operation", "message", "code", "class", "durationNs"}, ...], code and class only for git errors
+        [[nodiscard]] nlohmann::json ToJson() const;
+    private:
+        struct Text {
+            std::once_flag Once;
+            std::string Value;
+        };
+
+        std::vector<Record> mRecords;
+        // shared by the copies made while the list is thrown
+        std::shared_ptr<Text> mText{std::make_shared<Text>()};
+    };
+}
@@ -7,8 +7,18 @@
 // to be set aside for the sole purpose of error logging, and the allocation need extra processing
 // thus will be slow, but this is the only way we can implement it robustly and standard-compliant
 
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <cstdlib>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 #include <utility>
-#include <string>
 
 namespace {
     // 8 Mega binary bytes reserved for seh region in-case of OOM
@@ -16,58 +26,107 @@ namespace {
     constexpr int SehReserveSize = 8 * 1024 * 1024;
 
     // unit: uint32 flag+size; uint32 nextFree;
-    std::byte SehReserve[SehReserveSize] = {
-            static_cast<std::byte>(0x00),
-            static_cast<std::byte>(0x80),
-            static_cast<std::byte>(0x00),
-            static_cast<std::byte>(0x00)
+    // All zero at start, which is a valid empty state of the allocator below. That keeps the reserve in .bss: it takes
+    // no room in the binary, and no memory until its pages are first written or committed through SehCommit
+    alignas(16) std::byte SehReserve[SehReserveSize];
+
+    // The reserve is handed out in blocks of whole units. The header of a block fills its first unit, so payloads are
+    // aligned as malloc aligns them. The top bit of flag+size marks a block in use, the rest is its size in units,
+    // header included. Free blocks are linked through nextFree in address order, a freed block is merged with the
+    // free blocks on both sides of it. Unit 0 is never handed out, its nextFree is the head of the list and 0 ends it.
+    // Units from the bump mark on have never been handed out, taking them is lock-free, everything else is done under
+    // a spin lock, which unlike a mutex can neither fail nor allocate.
+    struct Header {
+        std::uint32_t FlagSize;
+        std::uint32_t NextFree;
     };
 
-    int firstFree = 0;
+    constexpr std::uint32_t Unit = 16;
+    constexpr std::uint32_t UnitCount = SehReserveSize / Unit;
+    constexpr std::uint32_t UsedFlag = 0x80000000u;
+
+    std::atomic<std::uint32_t> bumpMark{1};
+    std::atomic_flag listLock = ATOMIC_FLAG_INIT;
+    std::atomic<std::size_t> usedBytes{0}, peakBytes{0};
+    std::atomic<std::uint64_t> allocCount{0}, failCount{0};
+
+    class ListGuard {
+    public:
+        ListGuard() noexcept { while (listLock.test_and_set(std::memory_order_acquire)) std::this_thread::yield(); }
+        ListGuard(const ListGuard&) = delete;
+        ListGuard& operator=(const ListGuard&) = delete;
+        ~ListGuard() noexcept { listLock.clear(std::memory_order_release); }
+    };
+
+    Header& HeaderAt(std::uint32_t unit) noexcept { return *reinterpret_cast<Header*>(SehReserve + std::size_t(unit) * Unit); }
+    std::uint32_t SizeOf(std::uint32_t unit) noexcept { return HeaderAt(unit).FlagSize & ~UsedFlag; }
+
+    void* Hand(std::uint32_t unit, std::uint32_t units) noexcept {
+        HeaderAt(unit) = {UsedFlag | units, 0};
+        const auto used = usedBytes.fetch_add(std::size_t(units) * Unit, std::memory_order_relaxed) + std::size_t(units) * Unit;
+        auto peak = peakBytes.load(std::memory_order_relaxed);
+        while (peak < used && !peakBytes.compare_exchange_weak(peak, used, std::memory_order_relaxed)) {}
+        allocCount.fetch_add(1, std::memory_order_relaxed);
+        return SehReserve + std::size_t(unit + 1) * Unit;
+    }
 
     void* SHAlloc(int size) {
-        // TODO: Implement;
+        if (size <= 0) return nullptr;
+        const auto units = static_cast<std::uint32_t>((size + Unit - 1) / Unit + 1);
+        auto top = bumpMark.load(std::memory_order_relaxed);
+        while (top + units <= UnitCount) {
+            if (bumpMark.compare_exchange_weak(top, top + units, std::memory_order_acq_rel)) return Hand(top, units);
+        }
+        // first fit on the free list, what is left of a block stays in its place on the list
+        const ListGuard lk{};
+        for (std::uint32_t link = 0, x = HeaderAt(0).NextFree; x; link = x, x = HeaderAt(x).NextFree) {
+            const auto available = SizeOf(x);
+            if (available < units) continue;
+            if (available - units >= 2) {
+                HeaderAt(x + units) = {available - units, HeaderAt(x).NextFree};
+                HeaderAt(link).NextFree = x + units;
+                return Hand(x, units);
+            }
+            HeaderAt(link).NextFree = HeaderAt(x).NextFree;
+            return Hand(x, available);
+        }
+        failCount.fetch_add(1, std::memory_order_relaxed);
         return nullptr;
     }
 
     void SHFree(void* frag) {
-        // TODO: Implement;
-    }
-
-    std::string ConstructAggr(const std::vector<std::nested_exception>& e) {
-        static std::string_view message { "what(): aggregation of\n"};
-        std::vector<std::pair<const char*, int>> whats;
-        int size = 0;
-        whats.reserve(e.size());
-        for (auto& x : e) {
-            try { x.rethrow_nested(); }
-            catch (std::exception& e) {
-                const auto len = strlen(e.what());
-                whats.emplace_back(e.what(), len);
-                size += len + 2; //NOLINT
-            }
-            catch(...) {}
+        const auto block = static_cast<std::uint32_t>((static_cast<std::byte*>(frag) - SehReserve) / Unit - 1);
+        auto units = SizeOf(block);
+        usedBytes.fetch_sub(std::size_t(units) * Unit, std::memory_order_relaxed);
+        const ListGuard lk{};
+        // link is the free block right before this one, 0 if there is none
+        std::uint32_t before = 0, link = 0, next = HeaderAt(0).NextFree;
+        while (next && next < block) {
+            before = link;
+            link = next;
+            next = HeaderAt(next).NextFree;
+        }
+        auto start = block, owner = link;
+        if (next && start + units == next) {
+            units += SizeOf(next);
+            next = HeaderAt(next).NextFree;
+        }
+        if (link && link + SizeOf(link) == start) {
+            start = link;
+            units += SizeOf(link);
+            owner = before;
         }
-        std::string result;
-        result.resize(message.size() + size);
-        int p = message.size();
-        std::memcpy(result.data(), message.data(), p);
-        for (auto& [str, len] : whats) {
-            result[p++] = '\t';
-            std::memcpy(result.data() + p, str, len);
-            p+=len;
-            result[p++] = '\n';
+        // a block reaching up to the bump mark goes back to the untouched part instead of the list
+        if (auto top = start + units; !next && bumpMark.compare_exchange_strong(top, start, std::memory_order_acq_rel)) {
+            HeaderAt(owner).NextFree = 0;
+            return;
         }
-        result.back()='\0';
-        return result;
+        HeaderAt(start) = {units, next};
+        HeaderAt(owner).NextFree = start;
     }
 }
 
 namespace Utils {
-    AggregateException::AggregateException(std::vector<std::nested_exception>&& e) noexcept:
-        std::runtime_error(ConstructAggr(e)), mExceptions(std::move(e)) {
-    }
-
     void* SehMalloc(int size) {
         auto p = malloc(size);
         if (p) return p;
@@ -79,4 +138,48 @@ namespace Utils {
         const auto uf = static_cast<uintptr_t>(SehReserveSize);
         return (diff < uf) ? SHFree(frag) : free(frag);
     }
-}
\ No newline at end of file
+
+    SehUsage SehStats() noexcept {
+        return {
+                usedBytes.load(std::memory_order_relaxed), peakBytes.load(std::memory_order_relaxed), SehReserveSize,
+                allocCount.load(std::memory_order_relaxed), failCount.load(std::memory_order_relaxed)
+        };
+    }
+
+    bool SehCommit(bool lock) noexcept {
+#if defined(_WIN32)
+        SYSTEM_INFO info{};
+        GetSystemInfo(&info);
+        const auto page = static_cast<std::uintptr_t>(info.dwPageSize);
+#else
+        const auto page = static_cast<std::uintptr_t>(sysconf(_SC_PAGESIZE));
+#endif
+        // whole pages only, the partial ones at both ends are shared with neighbouring data that is in use anyway
+        const auto base = reinterpret_cast<std::uintptr_t>(SehReserve);
+        const auto first = (base + page - 1) / page * page;
+        const auto last = (base + SehReserveSize) / page * page;
+        if (last <= first) return true;
+        const auto begin = reinterpret_cast<void*>(first);
+        const auto size = static_cast<std::size_t>(last - first);
+#if defined(_WIN32)
+        // committing a page of a writable image section is a write to it, a locked page is committed as well
+        if (lock) return VirtualLock(begin, size) != 0;
+        for (auto x = first; x < last; x += page) {
+            reinterpret_cast<std::atomic<unsigned char>*>(x)->fetch_add(0, std::memory_order_relaxed);
+        }
+        return true;
+#else
+        // a locked range of a private mapping is faulted in for writing, so it is committed as well
+        if (lock) return mlock(begin, size) == 0;
+#if defined(MADV_POPULATE_WRITE)
+        if (madvise(begin, size, MADV_POPULATE_WRITE) == 0) return true;
+#endif
+        // reading would only map the shared zero page, a write that changes nothing commits the page safely even
+        // while blocks on it are in use
+        for (auto x = first; x < last; x += page) {
+            reinterpret_cast<std::atomic<unsigned char>*>(x)->fetch_add(0, std::memory_order_relaxed);
+        }
+        return true;
+#endif
+    }
+}
@@ -1,18 +1,21 @@
 #pragma once
 
-#include <vector>
-#include <exception>
+#include <cstdint>
+#include <cstddef>
 
 namespace Utils {
-    class AggregateException: public std::runtime_error {
-    public:
-        explicit AggregateException(std::vector<std::nested_exception>&& e) noexcept;
+    [[maybe_unused]] void* SehMalloc(int size);
+    [[maybe_unused]] void SehFree(void* frag);
 
-        [[nodiscard]] auto& nested() const noexcept { return mExceptions; }
-    private:
-        std::vector<std::nested_exception> mExceptions;
+    // Use of the memory set aside for when malloc fails, in bytes
+    struct SehUsage {
+        std::size_t InUse, Peak, Capacity;
+        std::uint64_t Allocations, Failures;
     };
 
-    [[maybe_unused]] void* SehMalloc(int size);
-    [[maybe_unused]] void SehFree(void* frag);
+    [[nodiscard]] SehUsage SehStats() noexcept;
+
+    // Backs the reserve with memory now rather than on its first use, which may be when no memory is left to back it.
+    // With lock the memory is also kept from being paged out, which may need privileges. False if that failed
+    bool SehCommit(bool lock = false) noexcept;
 }
\ No newline at end of file
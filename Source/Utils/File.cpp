@@ -0,0 +1,411 @@
+#include "File.h"
+
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <string>
+#include <utility>
+#include <system_error>
+
+#if defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#include <windows.h>
+#include <process.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+namespace {
+    [[noreturn]] void RaiseErrno(const char* what) { throw std::system_error(errno, std::generic_category(), what); }
+
+#if defined(_WIN32)
+    int OpenWrite(const std::filesystem::path& path, bool append) {
+        const int mode = append ? _O_APPEND : _O_TRUNC;
+        return _wopen(path.c_str(), mode | _O_WRONLY | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+    }
+
+    int SyncFd(int fd) noexcept { return _commit(fd); }
+    int CloseFd(int fd) noexcept { return _close(fd); }
+    int TruncateFd(int fd) noexcept { return _chsize_s(fd, 0); }
+    int ProcessId() noexcept { return _getpid(); }
+
+    bool ProcessAlive(int pid) noexcept {
+        const auto handle = OpenProcess(SYNCHRONIZE, FALSE, static_cast<DWORD>(pid));
+        if (!handle) return GetLastError() != ERROR_INVALID_PARAMETER;
+        const auto running = WaitForSingleObject(handle, 0) == WAIT_TIMEOUT;
+        CloseHandle(handle);
+        return running;
+    }
+    void SyncDirectory(const std::filesystem::path&) noexcept {} // NTFS journals the rename for us
+
+    int WriteFd(int fd, const char* data, std::size_t size) noexcept {
+        return _write(fd, data, static_cast<unsigned int>(size));
+    }
+
+    int OpenLock(const std::filesystem::path& path) {
+        return _wopen(path.c_str(), _O_RDWR | _O_CREAT | _O_BINARY | _O_NOINHERIT, _S_IREAD | _S_IWRITE);
+    }
+
+    // 0 once locked, EWOULDBLOCK if it is held elsewhere and we are not to wait
+    int LockFd(int fd, bool exclusive, bool wait) noexcept {
+        OVERLAPPED whole{};
+        DWORD flags = (exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0) | (wait ? 0 : LOCKFILE_FAIL_IMMEDIATELY);
+        const auto handle = reinterpret_cast<HANDLE>(_get_osfhandle(fd));
+        if (LockFileEx(handle, flags, 0, MAXDWORD, MAXDWORD, &whole)) return 0;
+        return GetLastError() == ERROR_LOCK_VIOLATION ? EWOULDBLOCK : EIO;
+    }
+#else
+    int OpenWrite(const std::filesystem::path& path, bool append) {
+        const int mode = append ? O_APPEND : O_TRUNC;
+        return open(path.c_str(), mode | O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    }
+
+    int SyncFd(int fd) noexcept { return fsync(fd); }
+    int CloseFd(int fd) noexcept { return close(fd); }
+    int TruncateFd(int fd) noexcept { return ftruncate(fd, 0); }
+    int ProcessId() noexcept { return getpid(); }
+    bool ProcessAlive(int pid) noexcept { return kill(pid, 0) == 0 || errno != ESRCH; }
+
+    void SyncDirectory(const std::filesystem::path& path) noexcept {
+        // the rename is only durable once the directory entry itself has been flushed
+        if (const auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC); fd >= 0) {
+            fsync(fd);
+            close(fd);
+        }
+    }
+
+    ssize_t WriteFd(int fd, const char* data, std::size_t size) noexcept { return write(fd, data, size); }
+
+    int OpenLock(const std::filesystem::path& path) { return open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644); }
+
+    // 0 once locked, EWOULDBLOCK if it is held elsewhere and we are not to wait
+    int LockFd(int fd, bool exclusive, bool wait) noexcept {
+        // flock locks belong to the open file, so two handles in one process exclude each other like two processes
+        const auto op = (exclusive ? LOCK_EX : LOCK_SH) | (wait ? 0 : LOCK_NB);
+        while (flock(fd, op) != 0) if (errno != EINTR) return errno;
+        return 0;
+    }
+#endif
+
+    void WriteAll(int fd, std::string_view data) {
+        while (!data.empty()) {
+            const auto written = WriteFd(fd, data.data(), data.size());
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                RaiseErrno("write");
+            }
+            data.remove_prefix(static_cast<std::size_t>(written));
+        }
+    }
+
+#if defined(__linux__)
+    // Try to share the data extents of source with a new file at target.
+    // Returns false without leaving target behind if the file system cannot do it
+    bool ShareExtents(const std::filesystem::path& source, const std::filesystem::path& target) {
+        const auto in = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) RaiseErrno("open");
+        const auto out = open(target.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (out < 0) {
+            close(in);
+            RaiseErrno("open");
+        }
+        const auto shared = ioctl(out, FICLONE, in) == 0;
+        close(in);
+        close(out);
+        if (!shared) std::filesystem::remove(target);
+        return shared;
+    }
+
+    // In-kernel copy, avoids the round trip of the data through user space
+    bool KernelCopy(const std::filesystem::path& source, const std::filesystem::path& target, std::uintmax_t size) {
+        const auto in = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) RaiseErrno("open");
+        const auto out = open(target.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (out < 0) {
+            close(in);
+            RaiseErrno("open");
+        }
+        auto left = size;
+        while (left > 0) {
+            const auto done = copy_file_range(in, nullptr, out, nullptr, left, 0);
+            if (done <= 0) break;
+            left -= static_cast<std::uintmax_t>(done);
+        }
+        close(in);
+        close(out);
+        if (left != 0) std::filesystem::remove(target);
+        return left == 0;
+    }
+#else
+    bool ShareExtents(const std::filesystem::path&, const std::filesystem::path&) { return false; }
+
+    bool KernelCopy(const std::filesystem::path&, const std::filesystem::path&, std::uintmax_t) { return false; }
+#endif
+
+    Utils::CloneStats CloneFile(const std::filesystem::path& source, const std::filesystem::path& target, Utils::CloneMode mode) {
+        const auto size = std::filesystem::file_size(source);
+        if (mode == Utils::CloneMode::HardLink) {
+            std::error_code ec{};
+            std::filesystem::create_hard_link(source, target, ec);
+            // cross-device and link count limits fall back to a copy
+            if (!ec) return {0, size};
+        }
+        else if (ShareExtents(source, target)) {
+            std::filesystem::permissions(target, std::filesystem::status(source).permissions());
+            return {0, size};
+        }
+        if (!KernelCopy(source, target, size)) std::filesystem::copy_file(source, target);
+        std::filesystem::permissions(target, std::filesystem::status(source).permissions());
+        return {size, 0};
+    }
+
+    std::filesystem::path TempSibling(const std::filesystem::path& path) {
+        auto name = path.filename();
+        name += Utils::UniqueName("") + ".tmp";
+        return path.parent_path()/name;
+    }
+}
+
+namespace Utils {
+    AppendFile::AppendFile(const std::filesystem::path& path): mFd(OpenWrite(path, true)) {
+        if (mFd < 0) RaiseErrno("open");
+    }
+
+    AppendFile::AppendFile(AppendFile&& other) noexcept: mFd(std::exchange(other.mFd, -1)) {}
+
+    AppendFile& AppendFile::operator=(AppendFile&& other) noexcept {
+        if (this != &other) {
+            if (mFd >= 0) CloseFd(mFd);
+            mFd = std::exchange(other.mFd, -1);
+        }
+        return *this;
+    }
+
+    AppendFile::~AppendFile() { if (mFd >= 0) CloseFd(mFd); }
+
+    void AppendFile::Write(std::string_view data) { WriteAll(mFd, data); }
+
+    void AppendFile::Sync() { if (SyncFd(mFd) != 0) RaiseErrno("fsync"); }
+
+    void AppendFile::Truncate() {
+        if (TruncateFd(mFd) != 0) RaiseErrno("ftruncate");
+        Sync();
+    }
+
+    FileLock::FileLock(const std::filesystem::path& path, Mode mode, bool wait): mFd(OpenLock(path)) {
+        if (mFd < 0) RaiseErrno("open");
+        if (const auto err = LockFd(mFd, mode == Exclusive, wait); err != 0) {
+            CloseFd(std::exchange(mFd, -1));
+            if (err != EWOULDBLOCK) throw std::system_error(err, std::generic_category(), "lock");
+        }
+    }
+
+    FileLock::FileLock(FileLock&& other) noexcept: mFd(std::exchange(other.mFd, -1)) {}
+
+    FileLock& FileLock::operator=(FileLock&& other) noexcept {
+        if (this != &other) {
+            if (mFd >= 0) CloseFd(mFd);
+            mFd = std::exchange(other.mFd, -1);
+        }
+        return *this;
+    }
+
+    // closing the handle lets go of the lock
+    FileLock::~FileLock() { if (mFd >= 0) CloseFd(mFd); }
+
+#if defined(_WIN32)
+    MappedFile::MappedFile(const std::filesystem::path& path) {
+        const auto file = CreateFileW(
+                path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr
+        );
+        if (file == INVALID_HANDLE_VALUE) throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), "open");
+        LARGE_INTEGER size{};
+        GetFileSizeEx(file, &size);
+        mSize = static_cast<std::size_t>(size.QuadPart);
+        bool ok = true;
+        if (mSize >= MapThreshold) {
+            const auto mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping) {
+                mData = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                CloseHandle(mapping);
+            }
+            ok = mMapped = mData != nullptr;
+        }
+        else if (mSize != 0) {
+            mBuffer.resize(mSize);
+            DWORD read = 0;
+            ok = ReadFile(file, mBuffer.data(), static_cast<DWORD>(mSize), &read, nullptr) && read == mSize;
+            mData = mBuffer.data();
+        }
+        const auto error = GetLastError();
+        CloseHandle(file);
+        if (!ok) throw std::system_error(static_cast<int>(error), std::system_category(), "read");
+    }
+
+    MappedFile::~MappedFile() { if (mMapped) UnmapViewOfFile(mData); }
+#else
+    MappedFile::MappedFile(const std::filesystem::path& path) {
+        const auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) RaiseErrno("open");
+        try {
+            struct stat info{};
+            if (fstat(fd, &info) != 0) RaiseErrno("stat");
+            mSize = static_cast<std::size_t>(info.st_size);
+            if (mSize >= MapThreshold) {
+                const auto data = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data == MAP_FAILED) RaiseErrno("mmap");
+                mData = static_cast<const char*>(data);
+                mMapped = true;
+            }
+            else {
+                mBuffer.resize(mSize);
+                std::size_t done = 0;
+                while (done < mSize) {
+                    const auto got = read(fd, mBuffer.data() + done, mSize - done);
+                    if (got < 0 && errno == EINTR) continue;
+                    if (got < 0) RaiseErrno("read");
+                    if (got == 0) break;
+                    done += static_cast<std::size_t>(got);
+                }
+                // the file got shorter since the stat, what was read is what there is
+                mBuffer.resize(mSize = done);
+                mData = mBuffer.data();
+            }
+        }
+        catch (...) {
+            close(fd);
+            throw;
+        }
+        close(fd);
+    }
+
+    MappedFile::~MappedFile() { if (mMapped) munmap(const_cast<char*>(mData), mSize); }
+#endif
+
+#if defined(_WIN32)
+    std::optional<FileStamp> StampOf(const std::filesystem::path& path) {
+        std::error_code ec{};
+        const auto size = std::filesystem::file_size(path, ec);
+        if (ec) return std::nullopt;
+        const auto time = std::filesystem::last_write_time(path, ec);
+        if (ec) return std::nullopt;
+        // NTFS has no inode numbers visible through the standard library, size and time have to do
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+        return FileStamp{size, static_cast<std::int64_t>(ns), 0};
+    }
+#else
+    std::optional<FileStamp> StampOf(const std::filesystem::path& path) {
+        struct stat st{};
+        if (stat(path.c_str(), &st)) {
+            if (errno==ENOENT || errno==ENOTDIR) return std::nullopt;
+            RaiseErrno("stat");
+        }
+#if defined(__APPLE__)
+        const auto& time = st.st_mtimespec;
+#else
+        const auto& time = st.st_mtim;
+#endif
+        return FileStamp{
+                static_cast<std::uintmax_t>(st.st_size),
+                static_cast<std::int64_t>(time.tv_sec)*1000000000+time.tv_nsec,
+                static_cast<std::uint64_t>(st.st_ino)
+        };
+    }
+#endif
+
+    std::uintmax_t TreeSize(const std::filesystem::path& path) {
+        std::uintmax_t size = 0;
+        for (auto&& x : std::filesystem::recursive_directory_iterator(path)) {
+            if (x.is_regular_file() && !x.is_symlink()) size += x.file_size();
+        }
+        return size;
+    }
+
+    void RemoveTree(const std::filesystem::path& path) {
+        std::error_code ec{};
+        std::filesystem::remove_all(path, ec);
+        if (!ec) return;
+        // entries of a read-only directory cannot be unlinked, give the write bits back and try again
+        const auto grant = [](const std::filesystem::path& x) {
+            std::error_code ignored{};
+            std::filesystem::permissions(x, std::filesystem::perms::owner_all, std::filesystem::perm_options::add, ignored);
+        };
+        for (auto i = std::filesystem::recursive_directory_iterator(path, ec); !ec && i != std::filesystem::recursive_directory_iterator(); i.increment(ec)) {
+            if (i->is_directory() && !i->is_symlink()) grant(i->path());
+        }
+        grant(path);
+        std::filesystem::remove_all(path);
+    }
+
+    std::string UniqueName(std::string_view prefix) {
+        static std::atomic_int counter{0};
+        return std::string(prefix) + "." + std::to_string(ProcessId()) + "." + std::to_string(counter++);
+    }
+
+    bool NameInUse(std::string_view name) {
+        // <prefix>.<pid>.<counter>
+        const auto counter = name.rfind('.');
+        if (counter == std::string_view::npos || counter == 0) return true;
+        const auto pid = name.rfind('.', counter - 1);
+        if (pid == std::string_view::npos) return true;
+        int value = 0;
+        for (const auto c : name.substr(pid + 1, counter - pid - 1)) {
+            if (c < '0' || c > '9' || value > 0x7FFFFFF) return true;
+            value = value * 10 + (c - '0');
+        }
+        return counter == pid + 1 || value == ProcessId() || ProcessAlive(value);
+    }
+
+    void WriteAtomic(const std::filesystem::path& path, std::string_view data) {
+        const auto temp = TempSibling(path);
+        try {
+            const auto fd = OpenWrite(temp, false);
+            if (fd < 0) RaiseErrno("open");
+            try {
+                WriteAll(fd, data);
+                if (SyncFd(fd) != 0) RaiseErrno("fsync");
+            }
+            catch (...) {
+                CloseFd(fd);
+                throw;
+            }
+            if (CloseFd(fd) != 0) RaiseErrno("close");
+            std::filesystem::rename(temp, path);
+        }
+        catch (...) {
+            std::error_code ec{};
+            std::filesystem::remove(temp, ec);
+            throw;
+        }
+        SyncDirectory(path.has_parent_path() ? path.parent_path() : std::filesystem::path("."));
+    }
+
+    CloneStats CloneTree(const std::filesystem::path& source, const std::filesystem::path& target, CloneMode mode, std::string_view skip) {
+        CloneStats stats{};
+        std::filesystem::create_directories(target);
+        for (auto i = std::filesystem::recursive_directory_iterator(source); i != std::filesystem::recursive_directory_iterator(); ++i) {
+            if (!skip.empty() && i->path().filename() == skip) {
+                i.disable_recursion_pending();
+                continue;
+            }
+            const auto to = target/i->path().lexically_relative(source);
+            if (i->is_symlink()) std::filesystem::copy_symlink(i->path(), to);
+            else if (i->is_directory()) std::filesystem::create_directory(to);
+            else if (i->is_regular_file()) stats += CloneFile(i->path(), to, mode);
+        }
+        return stats;
+    }
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <filesystem>
+
+namespace Utils {
+    // Append-only file handle. Data passed to Write() is only guaranteed to be on disk after Sync() returns
+    class AppendFile {
+    public:
+        AppendFile() noexcept = default;
+        explicit AppendFile(const std::filesystem::path& path);
+        AppendFile(AppendFile&& other) noexcept;
+        AppendFile& operator=(AppendFile&& other) noexcept;
+        ~AppendFile();
+        void Write(std::string_view data);
+        void Sync();
+        void Truncate();
+    private:
+        int mFd{-1};
+    };
+
+    // Advisory lock on a file, held until the object is destroyed.
+    // Other processes only see it if they lock the same file through FileLock as well
+    class FileLock {
+    public:
+        enum Mode { Shared, Exclusive };
+
+        FileLock() noexcept = default;
+        // Waits for the lock unless wait is false, in which case Held() tells whether it was free
+        FileLock(const std::filesystem::path& path, Mode mode, bool wait = true);
+        FileLock(FileLock&& other) noexcept;
+        FileLock& operator=(FileLock&& other) noexcept;
+        ~FileLock();
+        [[nodiscard]] bool Held() const noexcept { return mFd >= 0; }
+    private:
+        int mFd{-1};
+    };
+
+    // Read-only view of the whole content of a file.
+    // Large files are mapped, small ones are read in one go as setting up a mapping costs more than the copy
+    class MappedFile {
+    public:
+        explicit MappedFile(const std::filesystem::path& path);
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        ~MappedFile();
+        [[nodiscard]] std::string_view View() const noexcept { return {mData, mSize}; }
+    private:
+        static constexpr std::size_t MapThreshold = 256 * 1024;
+        const char* mData{nullptr};
+        std::size_t mSize{0};
+        bool mMapped{false};
+        std::string mBuffer;
+    };
+
+    // Identity of one version of a file. Replacing a file through WriteAtomic always changes the inode, even when
+    // size and modification time end up the same
+    struct FileStamp {
+        std::uintmax_t Size{0};
+        std::int64_t MTimeNs{0};
+        std::uint64_t Inode{0};
+
+        bool operator==(const FileStamp& other) const noexcept {
+            return Size==other.Size && MTimeNs==other.MTimeNs && Inode==other.Inode;
+        }
+        bool operator!=(const FileStamp& other) const noexcept { return !(*this==other); }
+    };
+
+    // Empty if the file does not exist
+    [[nodiscard]] std::optional<FileStamp> StampOf(const std::filesystem::path& path);
+
+    // Replace the content of the file with a write-to-temp, fsync, rename sequence.
+    // Readers either see the old content or the new content, never a partially written file
+    void WriteAtomic(const std::filesystem::path& path, std::string_view data);
+
+    // Total size of the regular files in the directory tree
+    [[nodiscard]] std::uintmax_t TreeSize(const std::filesystem::path& path);
+
+    // remove_all that also gets through directories left read-only
+    void RemoveTree(const std::filesystem::path& path);
+
+    // A name that no other call in this or any other live process on the host returns
+    std::string UniqueName(std::string_view prefix);
+
+    // Whether the process that got the name from UniqueName may still be running. True for names it did not make
+    [[nodiscard]] bool NameInUse(std::string_view name);
+
+    enum class CloneMode {
+        HardLink, // files are hard links to the source, edits go straight through to it
+        Reflink // files are copy-on-write clones where the file system supports it, plain copies otherwise
+    };
+
+    struct CloneStats {
+        std::uintmax_t Copied{0}, Shared{0};
+
+        CloneStats& operator+=(const CloneStats& other) noexcept {
+            Copied += other.Copied;
+            Shared += other.Shared;
+            return *this;
+        }
+    };
+
+    // Mirror the directory tree at source into target as real directories and files.
+    // Entries named skip are left out at any depth. Data that could not be shared with the source is copied
+    CloneStats CloneTree(const std::filesystem::path& source, const std::filesystem::path& target, CloneMode mode, std::string_view skip = {});
+}
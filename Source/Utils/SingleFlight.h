@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <exception>
+#include <mutex>
+#include <unordered_map>
+#include <condition_variable>
+
+namespace Utils {
+    // Coalesces calls for the same key.
+    // A caller arriving while a call for its key is running waits for it and shares its outcome, error included,
+    // instead of starting another one. A call that succeeded also stands in for the calls that arrive within the
+    // window after it, so a burst of retries does the work once. A failure is never reused past its own waiters.
+    class SingleFlight {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        explicit SingleFlight(Clock::duration window) noexcept: mWindow(window) {}
+
+        template <class Fn>
+        void Do(const std::string& key, Fn fn) {
+            std::unique_lock lk{mLock};
+            if (const auto i = mFlights.find(key); i!=mFlights.end()) {
+                const auto flight = i->second;
+                if (!flight->Done) {
+                    mDone.wait(lk, [&]() { return flight->Done; });
+                    if (flight->Error) std::rethrow_exception(flight->Error);
+                    return;
+                }
+                if (!flight->Error && Clock::now()-flight->Finished<mWindow) return;
+            }
+            Prune();
+            const auto flight = std::make_shared<Flight>();
+            mFlights.insert_or_assign(key, flight);
+            lk.unlock();
+            std::exception_ptr error{};
+            try { fn(); }
+            catch (...) { error = std::current_exception(); }
+            lk.lock();
+            flight->Done = true;
+            flight->Error = error;
+            flight->Finished = Clock::now();
+            // failures are only for the callers that joined, the next one tries again
+            if (error) mFlights.erase(key);
+            lk.unlock();
+            mDone.notify_all();
+            if (error) std::rethrow_exception(error);
+        }
+    private:
+        struct Flight {
+            bool Done{false};
+            std::exception_ptr Error;
+            Clock::time_point Finished;
+        };
+
+        // flights past their window stand in for nothing anymore, they go before the map can grow with them
+        void Prune() {
+            const auto now = Clock::now();
+            for (auto i = mFlights.begin(); i!=mFlights.end();) {
+                if (i->second->Done && now-i->second->Finished>=mWindow) i = mFlights.erase(i); else ++i;
+            }
+        }
+
+        Clock::duration mWindow;
+        std::mutex mLock;
+        std::condition_variable mDone;
+        std::unordered_map<std::string, std::shared_ptr<Flight>> mFlights;
+    };
+}
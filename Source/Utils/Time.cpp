@@ -0,0 +1,136 @@
+#include "Time.h"
+
+namespace {
+    constexpr std::string_view Weekdays[]{"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    constexpr std::string_view Months[]{"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+    constexpr std::int64_t FloorDiv(std::int64_t a, std::int64_t b) noexcept { return a/b-(a%b!=0 && (a<0)!=(b<0)); }
+
+    struct Civil {
+        std::int64_t Year;
+        unsigned Month, Day;
+    };
+
+    // inverse of DaysFromCivil
+    constexpr Civil CivilFromDays(std::int64_t days) noexcept {
+        days += 719468;
+        const auto era = (days>=0 ? days : days-146096)/146097;
+        const auto doe = static_cast<unsigned>(days-era*146097);
+        const auto yoe = (doe-doe/1460+doe/36524-doe/146096)/365;
+        const auto doy = doe-(365*yoe+yoe/4-yoe/100);
+        const auto mp = (5*doy+2)/153;
+        const auto month = mp<10 ? mp+3 : mp-9;
+        return {static_cast<std::int64_t>(yoe)+era*400+(month<=2), month, doy-(153*mp+2)/5+1};
+    }
+
+    static_assert(Utils::DaysFromCivil(1970, 1, 1)==0 && Utils::DaysFromCivil(2000, 3, 1)==11017);
+    static_assert(CivilFromDays(11017).Year==2000 && CivilFromDays(11017).Month==3 && CivilFromDays(11017).Day==1);
+
+    class Writer {
+    public:
+        explicit Writer(char* out) noexcept: mOut(out) {}
+        void Text(std::string_view text) noexcept { for (const char c : text) *mCursor++ = c; }
+        void Char(char c) noexcept { *mCursor++ = c; }
+
+        void Number(std::int64_t value, int width) noexcept {
+            if (value<0) Char('-');
+            auto rest = value<0 ? 0-static_cast<std::uint64_t>(value) : static_cast<std::uint64_t>(value);
+            char digits[20];
+            int count = 0;
+            do digits[count++] = static_cast<char>('0'+rest%10); while (rest /= 10);
+            for (int i = count; i<width; ++i) Char('0');
+            while (count) Char(digits[--count]);
+        }
+
+        [[nodiscard]] std::string_view Done() const noexcept { return {mOut, static_cast<std::size_t>(mCursor-mOut)}; }
+    private:
+        char* mOut;
+        char* mCursor{mOut};
+    };
+
+    class Reader {
+    public:
+        explicit Reader(std::string_view text) noexcept: mText(text) {}
+        [[nodiscard]] bool Done() const noexcept { return mText.empty(); }
+
+        bool Char(char c) noexcept {
+            if (mText.empty() || mText.front()!=c) return false;
+            mText.remove_prefix(1);
+            return true;
+        }
+
+        // index of the three letter name in the list, case does not matter
+        template <std::size_t N>
+        bool Name(const std::string_view (& names)[N], unsigned& index) noexcept {
+            if (mText.size()<3) return false;
+            for (index = 0; index<N; ++index) {
+                bool same = true;
+                for (std::size_t i = 0; i<3; ++i) same = same && (mText[i]|0x20)==(names[index][i]|0x20);
+                if (same) return mText.remove_prefix(3), true;
+            }
+            return false;
+        }
+
+        // between min and max digits
+        bool Number(int min, int max, std::int64_t& value) noexcept {
+            value = 0;
+            int count = 0;
+            for (; count<max && !mText.empty() && mText.front()>='0' && mText.front()<='9'; ++count) {
+                value = value*10+(mText.front()-'0');
+                mText.remove_prefix(1);
+            }
+            return count>=min;
+        }
+    private:
+        std::string_view mText;
+    };
+}
+
+namespace Utils {
+    std::string_view FormatLegacyTime(std::int64_t seconds, LegacyTimeText& out) noexcept {
+        const auto days = FloorDiv(seconds, 86400);
+        const auto time = seconds-days*86400;
+        const auto date = CivilFromDays(days);
+        // the epoch was a Thursday
+        const auto weekday = days+4-FloorDiv(days+4, 7)*7;
+        Writer writer{out.data()};
+        writer.Text(Weekdays[weekday]);
+        writer.Text(",-");
+        writer.Number(date.Day, 2);
+        writer.Char('-');
+        writer.Text(Months[date.Month-1]);
+        writer.Char('-');
+        writer.Number(date.Year, 4);
+        writer.Char('-');
+        writer.Number(time/3600, 2);
+        writer.Char(':');
+        writer.Number(time/60%60, 2);
+        writer.Char(':');
+        writer.Number(time%60, 2);
+        writer.Text("-+0000");
+        return writer.Done();
+    }
+
+    std::optional<std::int64_t> ParseLegacyTime(std::string_view text) noexcept {
+        Reader in{text};
+        unsigned weekday = 0, month = 0;
+        std::int64_t day = 0, year = 0, hour = 0, minute = 0, second = 0, zoneHour = 0, zoneMinute = 0;
+        // the weekday is only checked to be a name, the date says which day it was
+        if (!in.Name(Weekdays, weekday) || !in.Char(',') || !in.Char('-')) return std::nullopt;
+        if (!in.Number(1, 2, day) || !in.Char('-') || !in.Name(Months, month) || !in.Char('-')) return std::nullopt;
+        if (!in.Number(4, 5, year) || !in.Char('-')) return std::nullopt;
+        if (!in.Number(2, 2, hour) || !in.Char(':') || !in.Number(2, 2, minute) || !in.Char(':') || !in.Number(2, 2, second)) return std::nullopt;
+        if (!in.Char('-')) return std::nullopt;
+        const auto negative = in.Char('-');
+        if (!negative && !in.Char('+')) return std::nullopt;
+        if (!in.Number(2, 2, zoneHour)) return std::nullopt;
+        if (!in.Done()) {
+            in.Char(':');
+            if (!in.Number(2, 2, zoneMinute) || !in.Done()) return std::nullopt;
+        }
+        if (day<1 || day>31 || hour>23 || minute>59 || second>60 || zoneHour>23 || zoneMinute>59) return std::nullopt;
+        const auto zone = (zoneHour*60+zoneMinute)*60;
+        const auto local = DaysFromCivil(year, month+1, static_cast<unsigned>(day))*86400+hour*3600+minute*60+second;
+        return negative ? local+zone : local-zone;
+    }
+}
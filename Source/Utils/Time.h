@@ -0,0 +1,31 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace Utils {
+    // Whole seconds since the Unix epoch, the form times are stored in
+    struct UnixTime {
+        std::int64_t Seconds{0};
+    };
+
+    // Days since 1970-01-01 of a date of the proleptic Gregorian calendar, month and day counting from 1
+    constexpr std::int64_t DaysFromCivil(std::int64_t year, unsigned month, unsigned day) noexcept {
+        year -= month<=2;
+        const auto era = (year>=0 ? year : year-399)/400;
+        const auto yoe = static_cast<unsigned>(year-era*400);
+        const auto doy = (153*(month>2 ? month-3 : month+9)+2)/5+day-1;
+        const auto doe = yoe*365+yoe/4-yoe/100+doy;
+        return era*146097+static_cast<std::int64_t>(doe)-719468;
+    }
+
+    // Text of the form "Thu,-01-Jan-1970-00:00:00-+0000", in which times were stored before epoch seconds.
+    // Neither direction allocates, looks at the locale or at the time zone database
+    using LegacyTimeText = std::array<char, 40>;
+    // Always written in UTC
+    std::string_view FormatLegacyTime(std::int64_t seconds, LegacyTimeText& out) noexcept;
+    // Empty if the text is not of that form
+    [[nodiscard]] std::optional<std::int64_t> ParseLegacyTime(std::string_view text) noexcept;
+}
@@ -1,8 +1,41 @@
 #include "Manager/Manager.h"
+#include "Manager/InterOp.h"
+#include "Daemon/Server.h"
+#include "Utils/Exception.h"
+#include <csignal>
+#include <cstring>
 #include <iostream>
 
-int main() {
+namespace {
+    Configure::Daemon::Server* gServer = nullptr;
+
+    void OnSignal(int) { if (gServer) gServer->Stop(); }
+
+    // Dashboard.Kern --daemon <home> [socket]
+    int Serve(int argc, char** argv) {
+        using namespace Configure;
+        if (argc<3) {
+            std::cerr << "usage: " << argv[0] << " --daemon <home> [socket]" << std::endl;
+            return 2;
+        }
+        const std::filesystem::path home{argv[2]};
+        // a resident process runs long enough to meet memory pressure, have the error reserve backed before it does
+        Utils::SehCommit();
+        auto warehouse = Manager::Warehouse(home);
+        Daemon::Server server{warehouse, argc>3 ? std::filesystem::path{argv[3]} : home/Manager::InterOp::WarehouseDir/"Daemon.sock"};
+        gServer = &server;
+        std::signal(SIGINT, OnSignal);
+        std::signal(SIGTERM, OnSignal);
+        std::cout << "Serving " << home.string() << std::endl;
+        server.Run();
+        gServer = nullptr;
+        return 0;
+    }
+}
+
+int main(int argc, char** argv) {
     using namespace Configure::Manager;
+    if (argc>1 && std::strcmp(argv[1], "--daemon")==0) return Serve(argc, argv);
     std::string path;
     std::getline(std::cin, path);
     auto warehouse = Warehouse(path+"/home");
@@ -0,0 +1,54 @@
+// Reopening a journal whose records point into a directory removed after they were committed.
+// A module or cabinet removed from the warehouse leaves such records behind, they must not keep the journal from opening
+
+#include "Manager/Journal.h"
+#include "Utils/File.h"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+
+namespace {
+    int failures = 0;
+
+    void Check(bool ok, const char* what) {
+        if (ok) return;
+        std::fprintf(stderr, "FAILED: %s\n", what);
+        ++failures;
+    }
+
+    std::string Read(const std::filesystem::path& file) {
+        std::stringstream content{};
+        content << std::ifstream(file, std::ios::binary).rdbuf();
+        return content.str();
+    }
+}
+
+int main() {
+    using Configure::Manager::Journal;
+    const auto base = std::filesystem::temp_directory_path()/Utils::UniqueName("JournalReopen");
+    std::filesystem::create_directories(base/"Module");
+    {
+        Journal journal{base/"Journal"};
+        Journal::Batch batch{};
+        batch.Put(base/"Module"/"info.json", "removed");
+        batch.Put(base/"info.json", "kept");
+        journal.Commit(std::move(batch));
+        // before the compactor of the first one gets to the record
+        std::filesystem::remove_all(base/"Module");
+        try {
+            Journal reopened{base/"Journal"};
+            Check(Read(base/"info.json")=="kept", "writes into directories still there are folded");
+            Check(!std::filesystem::exists(base/"Module"), "removed directories are not made again");
+            Check(std::filesystem::file_size(base/"Journal")==0, "the journal is emptied");
+        }
+        catch (const std::exception& e) {
+            std::fprintf(stderr, "%s\n", e.what());
+            Check(false, "the journal opens");
+        }
+    }
+    Utils::RemoveTree(base);
+    if (failures) return 1;
+    std::printf("OK\n");
+    return 0;
+}
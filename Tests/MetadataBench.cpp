@@ -0,0 +1,158 @@
+// Benchmark of the typed metadata readers against parsing the same files into a document and picking the fields from it.
+// Writes a warehouse-sized set of metadata files into a temporary directory and reads them all in both ways.
+// The typed side decodes straight from the mapped file, like the loaders do when the document cache misses.
+//
+// MetadataBench [rounds]
+
+#include "Manager/InterOp.h"
+#include "Utils/File.h"
+#include "Utils/Time.h"
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <filesystem>
+
+using namespace Configure::Manager;
+using namespace Configure::Manager::InterOp;
+
+namespace {
+    constexpr int ModuleCount = 10000;
+    constexpr int CabinetCount = 200;
+    constexpr int CabinetSize = 50;
+    constexpr int BigCabinetSize = 20000;
+    constexpr int BigCabinetReads = 20;
+
+    std::size_t sink = 0;
+
+    template <class Fn>
+    double Time(Fn fn) {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count();
+    }
+
+    std::filesystem::path FileOf(const std::filesystem::path& dir, int i) { return dir/(std::to_string(i)+".json"); }
+
+    ModuleInfo SampleModule(int i) {
+        const auto name = "module" + std::to_string(i);
+        return {name, "https://example.com/modules/" + name + ".git", "Module " + std::to_string(i),
+                Utils::UnixTime{1600000000 + i}, Utils::UnixTime{1500000000 + i}};
+    }
+
+    CabinetInfo SampleCabinet(int i, int size) {
+        CabinetInfo info{"cabinet" + std::to_string(i), {}};
+        for (int k = 0; k<size; ++k) info.Modules.push_back(SampleModule(k));
+        return info;
+    }
+
+    void Generate(const std::filesystem::path& base) {
+        std::filesystem::create_directories(base/"info");
+        std::filesystem::create_directories(base/"manifest");
+        std::filesystem::create_directories(base/"cabinet");
+        for (int i = 0; i<ModuleCount; ++i) {
+            Json::Save(FileOf(base/"info", i), Json::Schema::Encode(SampleModule(i)), Json::Format::Compact);
+            ModuleManifest manifest{};
+            for (int k = 1; k<=i % 8; ++k) manifest.Depends.push_back("module" + std::to_string((i+k) % ModuleCount));
+            if (i % 3==0) manifest.Import.emplace_back("legacy.", "module" + std::to_string(i) + ".");
+            Json::Save(FileOf(base/"manifest", i), Json::Schema::Encode(manifest), Json::Format::Compact);
+        }
+        for (int i = 0; i<CabinetCount; ++i) {
+            Json::Save(FileOf(base/"cabinet", i), Json::Schema::Encode(SampleCabinet(i, CabinetSize)), Json::Format::Pretty);
+        }
+        Json::Save(base/"big.json", Json::Schema::Encode(SampleCabinet(0, BigCabinetSize)), Json::Format::Pretty);
+    }
+
+    template <class T>
+    T Typed(const std::filesystem::path& file) {
+        const Utils::MappedFile map{file};
+        return Json::Schema::Decode<T>(map.View());
+    }
+
+    // the document path, field by field as the loaders did before the typed readers
+    std::optional<std::string> StringOf(const nlohmann::json& json, std::string_view key) {
+        const auto it = json.find(key);
+        if (it==json.end() || !it->is_string()) return std::nullopt;
+        return it->get<std::string>();
+    }
+
+    std::optional<Utils::UnixTime> TimeOf(const nlohmann::json& json, std::string_view key) {
+        const auto it = json.find(key);
+        if (it==json.end()) return std::nullopt;
+        if (it->is_number_integer()) return Utils::UnixTime{it->get<std::int64_t>()};
+        if (!it->is_string()) return std::nullopt;
+        if (const auto seconds = Utils::ParseLegacyTime(it->get_ref<const std::string&>()); seconds) return Utils::UnixTime{*seconds};
+        return std::nullopt;
+    }
+
+    ModuleInfo ModuleOf(const nlohmann::json& json) {
+        return {StringOf(json, KeyModuleInfoId), StringOf(json, KeyModuleInfoUri), StringOf(json, KeyModuleInfoDisplay),
+                TimeOf(json, KeyModuleInfoLPull), TimeOf(json, KeyModuleInfoLCommit)};
+    }
+
+    CabinetInfo CabinetOf(const nlohmann::json& json) {
+        CabinetInfo info{StringOf(json, KeyCabinetNamespace), {}};
+        if (const auto it = json.find(KeyCabinetModules); it!=json.end() && it->is_array()) {
+            for (auto&& x : *it) if (x.is_object()) info.Modules.push_back(ModuleOf(x));
+        }
+        return info;
+    }
+
+    ModuleManifest ManifestOf(const nlohmann::json& json) {
+        ModuleManifest manifest{};
+        if (const auto it = json.find(KeyManifestDepends); it!=json.end() && it->is_array()) {
+            for (auto&& x : *it) if (x.is_string()) manifest.Depends.push_back(x.get<std::string>());
+        }
+        if (const auto it = json.find(KeyManifestImport); it!=json.end() && it->is_object()) {
+            for (auto&& [key, value] : it->items()) if (value.is_string()) manifest.Import.emplace_back(key, value.get<std::string>());
+        }
+        return manifest;
+    }
+
+    void Report(const char* what, double dom, double typed) {
+        std::printf("%-28s DOM %8.1fms  typed %8.1fms  %5.2fx\n", what, dom, typed, dom / typed);
+    }
+}
+
+int main(int argc, char** argv) {
+    const int rounds = argc>1 ? std::max(1, std::atoi(argv[1])) : 3;
+    const auto base = std::filesystem::temp_directory_path()/Utils::UniqueName("MetadataBench");
+    Generate(base);
+    // the first round warms the page cache, later ones are what is reported
+    for (int round = 0; round<=rounds; ++round) {
+        const auto infoDom = Time([&]() {
+            for (int i = 0; i<ModuleCount; ++i) sink += ModuleOf(Json::Load(FileOf(base/"info", i))).Id->size();
+        });
+        const auto infoTyped = Time([&]() {
+            for (int i = 0; i<ModuleCount; ++i) sink += Typed<ModuleInfo>(FileOf(base/"info", i)).Id->size();
+        });
+        const auto manifestDom = Time([&]() {
+            for (int i = 0; i<ModuleCount; ++i) sink += ManifestOf(Json::Load(FileOf(base/"manifest", i))).Depends.size();
+        });
+        const auto manifestTyped = Time([&]() {
+            for (int i = 0; i<ModuleCount; ++i) sink += Typed<ModuleManifest>(FileOf(base/"manifest", i)).Depends.size();
+        });
+        const auto cabinetDom = Time([&]() {
+            for (int i = 0; i<CabinetCount; ++i) sink += CabinetOf(Json::Load(FileOf(base/"cabinet", i))).Modules.size();
+        });
+        const auto cabinetTyped = Time([&]() {
+            for (int i = 0; i<CabinetCount; ++i) sink += Typed<CabinetInfo>(FileOf(base/"cabinet", i)).Modules.size();
+        });
+        const auto bigDom = Time([&]() {
+            for (int i = 0; i<BigCabinetReads; ++i) sink += CabinetOf(Json::Load(base/"big.json")).Modules.size();
+        });
+        const auto bigTyped = Time([&]() {
+            for (int i = 0; i<BigCabinetReads; ++i) sink += Typed<CabinetInfo>(base/"big.json").Modules.size();
+        });
+        if (round==0) continue;
+        std::printf("round %d\n", round);
+        Report("10k module info.json", infoDom, infoTyped);
+        Report("10k module.json", manifestDom, manifestTyped);
+        Report("200 cabinets x 50 modules", cabinetDom, cabinetTyped);
+        Report("20k module cabinet, 20 reads", bigDom, bigTyped);
+    }
+    Utils::RemoveTree(base);
+    return sink==0;
+}
@@ -0,0 +1,95 @@
+// Stress test of the emergency allocator with malloc failing throughout.
+// Linked with -Wl,--wrap=malloc so that every malloc call of the allocator lands in __wrap_malloc below
+
+#include "Utils/Exception.h"
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+
+namespace {
+    std::atomic_bool failMalloc{false};
+    int failures = 0;
+
+    void Check(bool ok, const char* what) {
+        if (ok) return;
+        std::fprintf(stderr, "FAILED: %s\n", what);
+        ++failures;
+    }
+
+    // allocates 1 MB blocks until the reserve is out of them
+    std::vector<void*> Fill() {
+        std::vector<void*> blocks{};
+        while (const auto p = Utils::SehMalloc(1000 * 1000)) blocks.push_back(p);
+        return blocks;
+    }
+}
+
+extern "C" void* __real_malloc(std::size_t size);
+extern "C" void* __wrap_malloc(std::size_t size) {
+    return failMalloc.load(std::memory_order_relaxed) ? nullptr : __real_malloc(size);
+}
+
+int main() {
+    failMalloc = true;
+    const auto a = Utils::SehMalloc(100), b = Utils::SehMalloc(200);
+    Check(a && b, "small allocations come from the reserve");
+    Check(reinterpret_cast<std::uintptr_t>(a) % 16 == 0, "blocks are aligned like malloc aligns them");
+    Utils::SehFree(a);
+    Utils::SehFree(b);
+    Check(Utils::SehStats().InUse == 0, "freed blocks go back to the reserve");
+
+    // free every other block first, then the rest, the holes have to coalesce again
+    const auto full = Fill();
+    Check(!full.empty() && Utils::SehStats().Failures > 0, "allocations fail once the reserve is used up");
+    for (std::size_t i = 0; i < full.size(); i += 2) Utils::SehFree(full[i]);
+    for (std::size_t i = 1; i < full.size(); i += 2) Utils::SehFree(full[i]);
+    Check(Utils::SehStats().InUse == 0, "the reserve is empty after all blocks are freed");
+    const auto again = Fill();
+    Check(again.size() == full.size(), "coalesced blocks fit as many allocations as before");
+    for (auto x : again) Utils::SehFree(x);
+
+    std::atomic_long corrupt{0};
+    std::vector<std::thread> threads{};
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([t, &corrupt]() {
+            std::mt19937 random(t);
+            std::vector<std::pair<unsigned char*, int>> live{};
+            const auto fill = [t](int size) { return static_cast<unsigned char>(t * 16 + (size & 15)); };
+            for (int i = 0; i < 200000; ++i) {
+                if (live.size() < 64 && (random() % 2 || live.empty())) {
+                    const int size = 1 + static_cast<int>(random() % 4000);
+                    const auto p = static_cast<unsigned char*>(Utils::SehMalloc(size));
+                    if (!p) continue;
+                    std::memset(p, fill(size), size);
+                    live.emplace_back(p, size);
+                    continue;
+                }
+                const auto k = random() % live.size();
+                const auto [p, size] = live[k];
+                for (int j = 0; j < size; ++j) {
+                    if (p[j] != fill(size)) {
+                        ++corrupt;
+                        break;
+                    }
+                }
+                Utils::SehFree(p);
+                live[k] = live.back();
+                live.pop_back();
+            }
+            for (auto [p, _] : live) Utils::SehFree(p);
+        });
+    }
+    for (auto& x : threads) x.join();
+    const auto stats = Utils::SehStats();
+    Check(corrupt == 0, "no block is handed out twice");
+    Check(stats.InUse == 0, "the reserve is empty after all threads freed their blocks");
+    Check(Fill().size() == full.size(), "concurrent use leaves no fragmentation behind");
+    failMalloc = false;
+    std::printf("peak %zu of %zu bytes, %llu allocations, %llu failures\n", stats.Peak, stats.Capacity,
+                static_cast<unsigned long long>(stats.Allocations), static_cast<unsigned long long>(stats.Failures));
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}